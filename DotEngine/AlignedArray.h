@@ -0,0 +1,62 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+/*
+ * Growable array of trivially copyable values with 64-byte aligned storage.
+ * The allocation is rounded up to whole cache lines plus one spare line, so
+ * SIMD kernels can always load a full vector past the last element.
+ */
+template <typename T> class AlignedArray {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "AlignedArray only holds plain data");
+
+public:
+  static constexpr size_t ALIGNMENT = 64;
+
+  AlignedArray() = default;
+  explicit AlignedArray(size_t size) { resize(size); }
+  ~AlignedArray() { std::free(m_data); }
+
+  AlignedArray(const AlignedArray &) = delete;
+  AlignedArray &operator=(const AlignedArray &) = delete;
+
+  /// Grows or shrinks, keeps the old values and zeroes new ones
+  void resize(size_t size) {
+    if (size > m_capacity) {
+      size_t capacity = m_capacity == 0 ? size : std::max(size, m_capacity * 2);
+      size_t bytes = ((capacity * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT + 1) *
+                     ALIGNMENT;
+      T *data = static_cast<T *>(std::aligned_alloc(ALIGNMENT, bytes));
+      if (data == nullptr)
+        throw std::bad_alloc();
+      std::memset(static_cast<void *>(data), 0, bytes);
+      if (m_data != nullptr) {
+        std::memcpy(static_cast<void *>(data), m_data, m_size * sizeof(T));
+        std::free(m_data);
+      }
+      m_data = data;
+      m_capacity = bytes / sizeof(T) - ALIGNMENT / sizeof(T);
+    } else if (size > m_size) {
+      std::memset(static_cast<void *>(m_data + m_size), 0,
+                  (size - m_size) * sizeof(T));
+    }
+    m_size = size;
+  }
+
+  T &operator[](size_t index) { return m_data[index]; }
+  const T &operator[](size_t index) const { return m_data[index]; }
+
+  T *data() { return m_data; }
+  const T *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  T *m_data = nullptr;
+  size_t m_size = 0;
+  size_t m_capacity = 0;
+};
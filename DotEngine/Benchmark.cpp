@@ -0,0 +1,439 @@
+#include "Benchmark.h"
+#include "Debug.h"
+#include "DotRenderer.h"
+#include "FrameTime.h"
+#include "Dots.h"
+#include "Game.h"
+#include "ScopeProfiler.h"
+#include "SimpleProfiler.h"
+#include "ThreadPool.h"
+
+// std
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+bool Benchmark::ParseArgs(int argc, char *argv[], BenchmarkOptions &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    // every option except the flags takes a value
+    bool hasValue = i + 1 < argc;
+
+    if (strcmp(arg, "--headless") == 0) {
+      options.headless = true;
+    } else if (strcmp(arg, "--raster") == 0) {
+      options.rasterize = true;
+    } else if (strcmp(arg, "--verify-grid") == 0) {
+      options.verifyGrid = true;
+    } else if (strcmp(arg, "--pipelined") == 0) {
+      options.pipelined = true;
+    } else if (strcmp(arg, "--scopes") == 0) {
+      options.profileScopes = true;
+    } else if (strcmp(arg, "--frames") == 0 && hasValue) {
+      options.frames = std::atoi(argv[++i]);
+    } else if (strcmp(arg, "--dots") == 0 && hasValue) {
+      options.dotCount = std::strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+      options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      options.hasSeed = true;
+    } else if (strcmp(arg, "--dt") == 0 && hasValue) {
+      options.deltaTime = std::strtof(argv[++i], nullptr);
+    } else if (strcmp(arg, "--step") == 0 && hasValue) {
+      options.fixedStep = std::strtof(argv[++i], nullptr);
+    } else if (strcmp(arg, "--max-substeps") == 0 && hasValue) {
+      options.maxSubsteps = std::atoi(argv[++i]);
+    } else if (strcmp(arg, "--grid") == 0 && hasValue) {
+      const char *grid = argv[++i];
+      if (strcmp(grid, "full") == 0) {
+        options.incrementalGrid = false;
+      } else if (strcmp(grid, "incremental") == 0) {
+        options.incrementalGrid = true;
+      } else {
+        Debug::LogError(std::string("[Benchmark] Unknown grid mode: ") + grid);
+        return false;
+      }
+    } else if (strcmp(arg, "--churn-threshold") == 0 && hasValue) {
+      options.churnThreshold = std::strtof(argv[++i], nullptr);
+    } else if (strcmp(arg, "--reorder") == 0 && hasValue) {
+      options.reorderInterval = std::atoi(argv[++i]);
+    } else if (strcmp(arg, "--collision") == 0 && hasValue) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "locked") == 0) {
+        options.collisionMode = Game::CollisionMode::Locked;
+      } else if (strcmp(mode, "phased") == 0) {
+        options.collisionMode = Game::CollisionMode::Phased;
+      } else if (strcmp(mode, "pairs") == 0) {
+        options.collisionMode = Game::CollisionMode::Pairs;
+      } else {
+        Debug::LogError(std::string("[Benchmark] Unknown collision mode: ") +
+                        mode);
+        return false;
+      }
+    } else if (strcmp(arg, "--broadphase") == 0 && hasValue) {
+      const char *type = argv[++i];
+      if (strcmp(type, "grid") == 0) {
+        options.broadphase = Broadphase::Type::Grid;
+      } else if (strcmp(type, "sap") == 0) {
+        options.broadphase = Broadphase::Type::SortAndSweep;
+      } else if (strcmp(type, "quadtree") == 0) {
+        options.broadphase = Broadphase::Type::LooseQuadtree;
+      } else if (strcmp(type, "cached") == 0) {
+        options.broadphase = Broadphase::Type::CachedGrid;
+      } else {
+        Debug::LogError(std::string("[Benchmark] Unknown broadphase: ") + type);
+        return false;
+      }
+    } else if (strcmp(arg, "--cache-margin") == 0 && hasValue) {
+      options.cacheMargin = std::strtof(argv[++i], nullptr);
+    } else if (strcmp(arg, "--scene") == 0 && hasValue) {
+      const char *scene = argv[++i];
+      if (strcmp(scene, "uniform") == 0) {
+        options.scene = Dots::Scene::Uniform;
+      } else if (strcmp(scene, "clustered") == 0) {
+        options.scene = Dots::Scene::Clustered;
+      } else {
+        Debug::LogError(std::string("[Benchmark] Unknown scene: ") + scene);
+        return false;
+      }
+    } else if (strcmp(arg, "--layout") == 0 && hasValue) {
+      const char *layout = argv[++i];
+      if (strcmp(layout, "float") == 0) {
+        options.layout = Game::DotLayout::Float;
+      } else if (strcmp(layout, "compact") == 0) {
+        options.layout = Game::DotLayout::Compact;
+      } else {
+        Debug::LogError(std::string("[Benchmark] Unknown layout: ") + layout);
+        return false;
+      }
+    } else if (strcmp(arg, "--simd") == 0 && hasValue) {
+      const char *simd = argv[++i];
+      if (strcmp(simd, "auto") == 0) {
+        options.simd = Simd::detected();
+      } else if (!Simd::parse(simd, options.simd)) {
+        Debug::LogError(std::string("[Benchmark] Unknown simd level: ") + simd);
+        return false;
+      }
+    } else if (strcmp(arg, "--trace") == 0 && hasValue) {
+      options.tracePath = argv[++i];
+      options.profileScopes = true;
+    } else if (strcmp(arg, "--load") == 0 && hasValue) {
+      options.loadPath = argv[++i];
+    } else if (strcmp(arg, "--save") == 0 && hasValue) {
+      options.savePath = argv[++i];
+    } else if (strcmp(arg, "--out") == 0 && hasValue) {
+      options.outputPath = argv[++i];
+    } else {
+      Debug::LogError(std::string("[Benchmark] Unknown argument: ") + arg);
+      return false;
+    }
+  }
+
+  if (options.frames <= 0 || options.deltaTime <= 0.f ||
+      options.dotCount == 0 || options.fixedStep <= 0.f ||
+      options.maxSubsteps <= 0) {
+    Debug::LogError("[Benchmark] --frames, --dots, --dt, --step and "
+                    "--max-substeps must be positive");
+    return false;
+  }
+  if (options.layout == Game::DotLayout::Compact &&
+      options.collisionMode != Game::CollisionMode::Phased)
+    Debug::LogWarning("[Benchmark] --layout compact always runs phased "
+                      "collisions, --collision is ignored");
+  if (options.reorderInterval < 0 || options.churnThreshold < 0.f ||
+      options.cacheMargin < 0.f) {
+    Debug::LogError("[Benchmark] --reorder, --churn-threshold and "
+                    "--cache-margin must not be negative");
+    return false;
+  }
+  return true;
+}
+
+void Benchmark::PrintUsage() {
+  std::cout << "Usage: DotEngine [options]\n"
+            << "  --headless      Run without a window and write a report\n"
+            << "  --frames <n>    Frames to simulate (default 600)\n"
+            << "  --dots <n>      Number of dots (default 25000)\n"
+            << "  --seed <n>      Fixed rng seed (headless default 1)\n"
+            << "  --dt <s>        Fixed frame time (default 1/60)\n"
+            << "  --step <s>      Simulation step (default 1/60)\n"
+            << "  --max-substeps <n> Most steps per frame (default 4)\n"
+            << "  --raster        Also rasterize into the CPU pixel buffer\n"
+            << "  --grid <g>      full or incremental grid updates "
+               "(default full)\n"
+            << "  --churn-threshold <f> Fraction of dots changing cell before "
+               "an incremental grid rebuilds (default 0.08)\n"
+            << "  --reorder <n>   Morton sort the dots every n steps, 0 never "
+               "(default 4)\n"
+            << "  --collision <m> locked, phased or pairs (default phased)\n"
+            << "  --broadphase <b> grid, sap, quadtree or cached, for "
+               "--collision pairs (default grid)\n"
+            << "  --cache-margin <px> Pair cache margin for --broadphase "
+               "cached (default 4)\n"
+            << "  --scene <s>     uniform or clustered dots (default uniform)\n"
+            << "  --layout <l>    float or compact dots (default float)\n"
+            << "  --simd <s>      auto, sse4, avx2 or avx512 kernels, capped at "
+               "what the cpu has (default auto)\n"
+            << "  --verify-grid   Check the parallel grid against a serial one\n"
+            << "  --pipelined     Simulate the next frame while rasterizing\n"
+            << "  --scopes        Also report the scope profiler, worker time "
+               "included\n"
+            << "  --trace <file>  Write a Chrome trace of every frame, implies "
+               "--scopes\n"
+            << "  --load <file>   Start from a dots snapshot, overrides --dots\n"
+            << "  --save <file>   Save a dots snapshot after the last frame\n"
+            << "  --out <file>    Report file, .csv or .json "
+               "(default benchmark_report.csv)\n";
+}
+
+static const char *collisionName(Game::CollisionMode mode) {
+  switch (mode) {
+  case Game::CollisionMode::Locked:
+    return "locked";
+  case Game::CollisionMode::Pairs:
+    return "pairs";
+  case Game::CollisionMode::Phased:
+  default:
+    return "phased";
+  }
+}
+
+// a / b, 0 when nothing was counted
+static double ratio(uint64_t a, uint64_t b) {
+  return b > 0 ? double(a) / b : 0.0;
+}
+
+static bool endsWith(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int Benchmark::Run(const BenchmarkOptions &options) {
+  Debug::Log("HEADLESS BENCHMARK START");
+
+  // headless runs are always seeded, otherwise runs can't be compared
+  Dots::setSeed(options.seed);
+  Dots::setScene(options.scene);
+
+  ThreadPool *threadPool = new ThreadPool();
+  SimpleProfiler *profiler = new SimpleProfiler("benchmark");
+  auto &totalClock = profiler->start("total");
+  auto &renderClock = profiler->start("render_total");
+
+  DotRenderer *renderer =
+      options.rasterize ? new DotRenderer(threadPool, totalClock) : nullptr;
+  new Debug(nullptr, nullptr); // values only, owned by Debug::Instance
+  Game *game = new Game(renderer, threadPool, totalClock, options.dotCount);
+  game->setCollisionMode(options.collisionMode);
+  game->setPairCacheMargin(options.cacheMargin);
+  game->setBroadphase(options.broadphase);
+  game->setVerifyGrid(options.verifyGrid);
+  game->setFixedStep(options.fixedStep, options.maxSubsteps);
+  game->setReorderInterval(options.reorderInterval);
+  game->setIncrementalGrid(options.incrementalGrid, options.churnThreshold);
+
+  if (!options.loadPath.empty() && !game->loadDots(options.loadPath)) {
+    // nothing to replay, and writing the report or --save now would replace
+    // the files the user meant to compare with
+    Debug::LogError("[Benchmark] Could not load " + options.loadPath);
+    delete game;
+    delete renderer;
+    delete threadPool;
+    delete profiler;
+    Debug::DeleteInstance();
+    return 1;
+  }
+  game->setDotLayout(options.layout);
+  ScopeProfiler::SetThreadName("main");
+  ScopeProfiler::SetEnabled(options.profileScopes);
+  ScopeProfiler::SetTracing(!options.tracePath.empty());
+
+  // spawned dots sit at random indices, so this is the unsorted baseline
+  const double startLocality = game->measureLocality();
+
+  FrameHistogram frameTimes; // every frame, not a window
+  uint64_t pairTotal = 0;     // candidate pairs, --collision pairs only
+  uint64_t pairFrames = 0;
+  PairCacheStats cacheTotal;  // summed over frames, --broadphase cached only
+  double churnTotal = 0.0;    // grid churn, --grid incremental only
+  int incrementalFrames = 0;  // frames whose last grid update was incremental
+  for (int frame = 0; frame < options.frames; ++frame) {
+    PROFILE_SCOPE("frame");
+    auto frameStart = std::chrono::steady_clock::now();
+    totalClock.startClock();
+    if (options.pipelined) {
+      renderClock.startClock();
+      game->beginFrame(options.deltaTime);
+      game->renderFrame(renderClock);
+      renderClock.stopClock();
+      game->endFrame();
+    } else {
+      game->Update(options.deltaTime);
+    }
+    totalClock.stopClock();
+    frameTimes.Record(std::chrono::duration<float, std::milli>(
+                          std::chrono::steady_clock::now() - frameStart)
+                          .count());
+    if (game->getEffectiveCollisionMode() == Game::CollisionMode::Pairs) {
+      pairTotal += game->getLastPairCount();
+      pairFrames++;
+      const PairCacheStats cache = game->getPairCacheStats();
+      cacheTotal.cleanDots += cache.cleanDots;
+      cacheTotal.dirtyDots += cache.dirtyDots;
+      cacheTotal.cachedPairs += cache.cachedPairs;
+      cacheTotal.pairHits += cache.pairHits;
+      cacheTotal.pairMisses += cache.pairMisses;
+    }
+    churnTotal += game->getGridChurn();
+    incrementalFrames += game->wasGridIncremental();
+
+    // drain the per thread rings every frame so they never fill up
+    if (options.profileScopes)
+      ScopeProfiler::Collect();
+  }
+
+  // the scope of the last frame closed after its Collect
+  if (options.profileScopes)
+    ScopeProfiler::Collect();
+
+  profiler->reportTimersFull(false);
+
+  const double endLocality = game->measureLocality();
+  std::stringstream localityText;
+  localityText << "[Benchmark] Mean index distance of cell neighbours: "
+               << startLocality << " -> " << endLocality;
+  Debug::Log(localityText.str());
+
+  // write the report, the format is picked from the file extension
+  std::stringstream report;
+  if (endsWith(options.outputPath, ".json")) {
+    report << "{\n"
+           << "  \"frames\": " << options.frames << ",\n"
+           << "  \"seed\": " << options.seed << ",\n"
+           << "  \"delta_time\": " << options.deltaTime << ",\n"
+           << "  \"fixed_step\": " << options.fixedStep << ",\n"
+           << "  \"max_substeps\": " << options.maxSubsteps << ",\n"
+           << "  \"dots\": " << game->getDotCount() << ",\n"
+           << "  \"threads\": " << threadPool->num_threads << ",\n"
+           << "  \"rasterize\": " << (options.rasterize ? "true" : "false")
+           << ",\n"
+           << "  \"pipelined\": " << (options.pipelined ? "true" : "false")
+           << ",\n"
+           << "  \"collision\": \""
+           << collisionName(game->getEffectiveCollisionMode()) << "\",\n"
+           << "  \"collision_requested\": \""
+           << collisionName(options.collisionMode) << "\",\n"
+           << "  \"broadphase\": \"" << Broadphase::typeName(options.broadphase)
+           << "\",\n"
+           << "  \"scene\": \""
+           << (options.scene == Dots::Scene::Clustered ? "clustered" : "uniform")
+           << "\",\n"
+           << "  \"avg_candidate_pairs\": "
+           << (pairFrames > 0 ? double(pairTotal) / pairFrames : 0.0) << ",\n"
+           << "  \"pair_cache\": {\"margin\": " << options.cacheMargin
+           << ", \"hit_rate\": "
+           << ratio(cacheTotal.pairHits,
+                    cacheTotal.pairHits + cacheTotal.pairMisses)
+           << ", \"dirty_fraction\": "
+           << ratio(cacheTotal.dirtyDots,
+                    cacheTotal.dirtyDots + cacheTotal.cleanDots)
+           << ", \"avg_cached_pairs\": "
+           << ratio(cacheTotal.cachedPairs, pairFrames) << "},\n"
+           << "  \"layout\": \""
+           << (options.layout == Game::DotLayout::Compact ? "compact" : "float")
+           << "\",\n"
+           << "  \"bytes_per_dot\": " << game->getBytesPerDot() << ",\n"
+           << "  \"simd\": \"" << Simd::name(Simd::active()) << "\",\n"
+           << "  \"simd_detected\": \"" << Simd::name(Simd::detected())
+           << "\",\n"
+           << "  \"grid\": \""
+           << (options.incrementalGrid ? "incremental" : "full") << "\",\n"
+           << "  \"churn_threshold\": " << options.churnThreshold << ",\n"
+           << "  \"avg_grid_churn\": " << churnTotal / options.frames << ",\n"
+           << "  \"incremental_grid_frames\": " << incrementalFrames << ",\n"
+           << "  \"reorder_interval\": " << options.reorderInterval << ",\n"
+           << "  \"index_distance\": {\"start\": " << startLocality
+           << ", \"end\": " << endLocality << "},\n"
+           << "  \"frame_time_ms\": {\"p50\": " << frameTimes.Percentile(0.5f)
+           << ", \"p90\": " << frameTimes.Percentile(0.9f)
+           << ", \"p99\": " << frameTimes.Percentile(0.99f)
+           << ", \"p99_9\": " << frameTimes.Percentile(0.999f)
+           << ", \"max\": " << frameTimes.Max()
+           << ", \"mean\": " << frameTimes.Mean() << "},\n"
+           << "  \"timers\": " << profiler->getTimersJSON();
+    if (options.profileScopes)
+      report << ",\n  \"scopes\": " << ScopeProfiler::GetStatsJSON()
+             << ",\n  \"dropped_scope_events\": "
+             << ScopeProfiler::DroppedEvents();
+    report << "\n"
+           << "}\n";
+  } else {
+    report << profiler->getTimersCSV();
+    // percentiles only have a value, it goes in the avg_ms column
+    const std::pair<const char *, float> percentiles[] = {
+        {"p50", frameTimes.Percentile(0.5f)},
+        {"p90", frameTimes.Percentile(0.9f)},
+        {"p99", frameTimes.Percentile(0.99f)},
+        {"p99_9", frameTimes.Percentile(0.999f)},
+        {"max", frameTimes.Max()}};
+    report << std::fixed << std::setprecision(4);
+    for (const auto &[name, value] : percentiles)
+      report << "frame_time/" << name << ",1," << value << ",,,,"
+             << frameTimes.Count() << "\n";
+    // same for the grid, calls is the number of frames
+    report << "grid/avg_churn,1," << churnTotal / options.frames << ",,,,"
+           << options.frames << "\n"
+           << "grid/incremental_frames,1," << incrementalFrames << ",,,,"
+           << options.frames << "\n";
+    // and the pairs, counted over the frames that ran pairs mode
+    const std::pair<const char *, double> pairStats[] = {
+        {"pairs/avg_candidate", ratio(pairTotal, pairFrames)},
+        {"pair_cache/hit_rate",
+         ratio(cacheTotal.pairHits,
+               cacheTotal.pairHits + cacheTotal.pairMisses)},
+        {"pair_cache/dirty_fraction",
+         ratio(cacheTotal.dirtyDots,
+               cacheTotal.dirtyDots + cacheTotal.cleanDots)},
+        {"pair_cache/avg_cached_pairs",
+         ratio(cacheTotal.cachedPairs, pairFrames)}};
+    for (const auto &[name, value] : pairStats)
+      report << name << ",1," << value << ",,,," << pairFrames << "\n";
+    if (options.profileScopes)
+      report << ScopeProfiler::GetStatsCSV();
+  }
+
+  int exitCode = 0;
+  if (!options.savePath.empty() && !game->saveDots(options.savePath))
+    exitCode = 1;
+
+  std::ofstream reportFile(options.outputPath);
+  if (reportFile.is_open()) {
+    reportFile << report.str();
+    Debug::Log("[Benchmark] Report saved to " + options.outputPath);
+  } else {
+    Debug::LogError("[Benchmark] Could not open " + options.outputPath);
+    exitCode = 1;
+  }
+
+  if (!options.tracePath.empty()) {
+    if (ScopeProfiler::WriteChromeTrace(options.tracePath)) {
+      Debug::Log("[Benchmark] Trace saved to " + options.tracePath);
+    } else {
+      Debug::LogError("[Benchmark] Could not write " + options.tracePath);
+      exitCode = 1;
+    }
+  }
+
+  Debug::OutputScreenFields();
+
+  delete game;
+  delete renderer;
+  delete threadPool;
+  delete profiler;
+  Debug::DeleteInstance();
+
+  return exitCode;
+}
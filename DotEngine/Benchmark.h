@@ -0,0 +1,59 @@
+#pragma once
+#include "Game.h"
+#include "Simd.h"
+#include <cstdint>
+#include <string>
+
+struct BenchmarkOptions {
+  bool headless = false;
+  int frames = 600;
+  size_t dotCount = Dots::DEFAULT_DOTS;
+  uint32_t seed = 1;
+  bool hasSeed = false;
+  Simd::Level simd = Simd::detected(); // kernels to run, --simd lowers it
+  float deltaTime = 1.f / 60.f; // fixed frame time, so runs are comparable
+  float fixedStep = Game::DEFAULT_FIXED_STEP; // simulation step
+  int maxSubsteps = Game::DEFAULT_MAX_SUBSTEPS;
+  bool rasterize = false;       // also run the CPU rasterizer
+  std::string outputPath = "benchmark_report.csv"; // .json writes JSON
+  Game::CollisionMode collisionMode = Game::CollisionMode::Phased;
+  Game::DotLayout layout = Game::DotLayout::Float;
+  Broadphase::Type broadphase = Broadphase::Type::Grid; // --collision pairs
+  float cacheMargin = CachedGridBroadphase::DEFAULT_MARGIN; // --broadphase cached
+  Dots::Scene scene = Dots::Scene::Uniform;
+  int reorderInterval = Game::DEFAULT_REORDER_INTERVAL; // 0 never sorts
+  bool incrementalGrid = false; // move changed dots instead of rebuilding
+  float churnThreshold = SpatialGrid::DEFAULT_CHURN_THRESHOLD;
+  bool verifyGrid = false; // compare the parallel grid with the serial one
+  bool pipelined = false;  // simulate the next frame while rasterizing
+  bool profileScopes = false; // record PROFILE_SCOPEs on every thread
+  std::string tracePath;       // Chrome trace output, empty for none
+  std::string loadPath;        // start from this dots snapshot
+  std::string savePath;        // snapshot of the dots after the last frame
+};
+
+/*
+ * Runs the simulation without a window for a fixed amount of frames, and
+ * writes the SimpleProfiler timer tree to a CSV or JSON file.
+ */
+class Benchmark {
+public:
+  /*
+   * Parses the command line into benchmark options
+   *
+   * @param argc Argument count from main
+   * @param argv Arguments from main
+   * @param options The options to fill in
+   * @return false if the arguments were invalid
+   */
+  static bool ParseArgs(int argc, char *argv[], BenchmarkOptions &options);
+  static void PrintUsage();
+
+  /*
+   * Runs the headless benchmark
+   *
+   * @param options The benchmark options
+   * @return The process exit code
+   */
+  static int Run(const BenchmarkOptions &options);
+};
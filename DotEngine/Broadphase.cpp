@@ -0,0 +1,486 @@
+#include "Broadphase.h"
+#include "Dots.h"
+#include "ScopeProfiler.h"
+#include "Settings.h"
+#include "ThreadPool.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+// bounding boxes overlap, the narrow phase only runs on these
+inline bool boxesOverlap(const Dots &dots, size_t i, size_t j) {
+  const float reach = float(dots.radii[i]) + float(dots.radii[j]);
+  return std::fabs(dots.positions_x[i] - dots.positions_x[j]) < reach &&
+         std::fabs(dots.positions_y[i] - dots.positions_y[j]) < reach;
+}
+
+inline CandidatePair makePair(size_t i, size_t j) {
+  return i < j ? CandidatePair{uint32_t(i), uint32_t(j)}
+               : CandidatePair{uint32_t(j), uint32_t(i)};
+}
+} // namespace
+
+std::unique_ptr<Broadphase> Broadphase::create(Type type) {
+  switch (type) {
+  case Type::SortAndSweep:
+    return std::make_unique<SortAndSweepBroadphase>();
+  case Type::LooseQuadtree:
+    return std::make_unique<LooseQuadtreeBroadphase>();
+  case Type::CachedGrid:
+    return std::make_unique<CachedGridBroadphase>();
+  case Type::Grid:
+  default:
+    return std::make_unique<GridBroadphase>();
+  }
+}
+
+const char *Broadphase::typeName(Type type) {
+  switch (type) {
+  case Type::SortAndSweep:
+    return "sap";
+  case Type::LooseQuadtree:
+    return "quadtree";
+  case Type::CachedGrid:
+    return "cached";
+  case Type::Grid:
+  default:
+    return "grid";
+  }
+}
+
+void Broadphase::joinChunks(std::vector<CandidatePair> &pairs) {
+  size_t total = 0;
+  for (const auto &chunk : chunkPairs)
+    total += chunk.size();
+  pairs.clear();
+  pairs.reserve(total);
+  for (const auto &chunk : chunkPairs)
+    pairs.insert(pairs.end(), chunk.begin(), chunk.end());
+}
+
+// ####################
+// ##      GRID:     ##
+// ####################
+void GridBroadphase::findPairs(const Dots &dots, ThreadPool *threadPool,
+                               std::vector<CandidatePair> &pairs) {
+  PROFILE_SCOPE("broadphase_grid");
+  // half stencil, the other four neighbours reach this cell through theirs
+  static constexpr int HALF_STENCIL[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+  grid.rebuild(dots, threadPool);
+
+  // one chunk per grid row
+  chunkPairs.resize(SpatialGrid::GRID_HEIGHT);
+  threadPool->parallel_for(
+      0, SpatialGrid::GRID_HEIGHT, 1, [&](size_t first, size_t last) {
+        for (size_t row = first; row < last; row++) {
+          auto &out = chunkPairs[row];
+          out.clear();
+          const int gy = static_cast<int>(row);
+          for (int gx = 0; gx < SpatialGrid::GRID_WIDTH; gx++) {
+            auto home = grid.cell(gx, gy);
+
+            // pairs inside the cell
+            for (uint32_t a = 0; a < home.count; a++) {
+              for (uint32_t b = a + 1; b < home.count; b++) {
+                if (boxesOverlap(dots, home.indices[a], home.indices[b]))
+                  out.push_back(makePair(home.indices[a], home.indices[b]));
+              }
+            }
+
+            // pairs with the neighbouring cells
+            for (const auto &offset : HALF_STENCIL) {
+              const int nx = gx + offset[0];
+              const int ny = gy + offset[1];
+              if (nx < 0 || nx >= SpatialGrid::GRID_WIDTH ||
+                  ny >= SpatialGrid::GRID_HEIGHT)
+                continue;
+              for (uint32_t i : home) {
+                for (uint32_t j : grid.cell(nx, ny)) {
+                  if (boxesOverlap(dots, i, j))
+                    out.push_back(makePair(i, j));
+                }
+              }
+            }
+          }
+        }
+      });
+
+  joinChunks(pairs);
+}
+
+// ####################
+// ##  SORT & SWEEP: ##
+// ####################
+void SortAndSweepBroadphase::findPairs(const Dots &dots, ThreadPool *threadPool,
+                                       std::vector<CandidatePair> &pairs) {
+  PROFILE_SCOPE("broadphase_sap");
+  // columns are clamped, so dots pushed off the screen still sort in order
+  auto columnOf = [](float x) {
+    return static_cast<uint32_t>(
+        std::clamp(std::floor(x), 0.f, float(Settings::SCREEN_WIDTH)));
+  };
+
+  // counting sort on the column of the left edge, stable
+  const size_t aliveCount = dots.alive_indices.size();
+  columnStart.assign(Settings::SCREEN_WIDTH + 2, 0);
+  dotColumn.resize(aliveCount);
+  for (size_t k = 0; k < aliveCount; k++) {
+    const size_t i = dots.alive_indices[k];
+    dotColumn[k] = columnOf(dots.positions_x[i] - dots.radii[i]);
+    columnStart[dotColumn[k] + 1]++;
+  }
+  for (size_t c = 1; c < columnStart.size(); c++)
+    columnStart[c] += columnStart[c - 1];
+
+  sorted.resize(aliveCount);
+  column.resize(aliveCount);
+  for (size_t k = 0; k < aliveCount; k++) {
+    const uint32_t slot = columnStart[dotColumn[k]]++;
+    sorted[slot] = static_cast<uint32_t>(dots.alive_indices[k]);
+    column[slot] = dotColumn[k];
+  }
+
+  // sweep, a dot only meets the dots whose left edge column is not past its
+  // right edge. The order inside a column is arbitrary, but every
+  // overlapping pair is still met from the one that comes first.
+  const size_t numChunks = (aliveCount + SWEEP_GRAIN - 1) / SWEEP_GRAIN;
+  chunkPairs.resize(numChunks);
+  threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      auto &out = chunkPairs[chunk];
+      out.clear();
+      const size_t end = std::min(aliveCount, (chunk + 1) * SWEEP_GRAIN);
+      for (size_t s = chunk * SWEEP_GRAIN; s < end; s++) {
+        const uint32_t i = sorted[s];
+        const uint32_t lastColumn =
+            columnOf(dots.positions_x[i] + dots.radii[i]);
+        for (size_t t = s + 1; t < aliveCount && column[t] <= lastColumn;
+             t++) {
+          if (boxesOverlap(dots, i, sorted[t]))
+            out.push_back(makePair(i, sorted[t]));
+        }
+      }
+    }
+  });
+
+  joinChunks(pairs);
+}
+
+// ####################
+// ##   QUADTREE:    ##
+// ####################
+void LooseQuadtreeBroadphase::split(const Dots &dots, uint32_t node,
+                                    uint32_t begin, uint32_t end, int depth) {
+  const Node parent = nodes[node]; // nodes grows below
+  const float midX = (parent.minX + parent.maxX) * 0.5f;
+  const float midY = (parent.minY + parent.maxY) * 0.5f;
+  // a child holds radii up to a quarter of its smaller side
+  const float childFit =
+      std::min(parent.maxX - parent.minX, parent.maxY - parent.minY) * 0.25f;
+
+  // stable counting sort, dots that fit no child stay in front
+  uint32_t counts[5] = {};
+  for (uint32_t s = begin; s < end; s++) {
+    const uint32_t i = sorted[s];
+    uint8_t b = 0;
+    if (dots.radii[i] <= childFit)
+      b = 1 + (dots.positions_x[i] >= midX) + 2 * (dots.positions_y[i] >= midY);
+    bucket[s] = b;
+    counts[b]++;
+  }
+  if (counts[0] == end - begin) {
+    nodes[node].first = begin;
+    nodes[node].count = end - begin;
+    return;
+  }
+
+  uint32_t offsets[6] = {begin};
+  for (int b = 0; b < 5; b++)
+    offsets[b + 1] = offsets[b] + counts[b];
+  uint32_t cursor[5];
+  std::copy(offsets, offsets + 5, cursor);
+  for (uint32_t s = begin; s < end; s++)
+    scratch[cursor[bucket[s]]++] = sorted[s];
+  std::copy(scratch.begin() + begin, scratch.begin() + end,
+            sorted.begin() + begin);
+
+  nodes[node].first = begin;
+  nodes[node].count = counts[0];
+  nodes[node].child = static_cast<int32_t>(nodes.size());
+  for (int q = 0; q < 4; q++) {
+    Node child;
+    child.minX = q & 1 ? midX : parent.minX;
+    child.maxX = q & 1 ? parent.maxX : midX;
+    child.minY = q & 2 ? midY : parent.minY;
+    child.maxY = q & 2 ? parent.maxY : midY;
+    nodes.push_back(child);
+  }
+
+  const uint32_t firstChild = static_cast<uint32_t>(nodes[node].child);
+  for (int q = 0; q < 4; q++) {
+    const uint32_t from = offsets[q + 1];
+    const uint32_t to = offsets[q + 2];
+    if (to - from > SPLIT_COUNT && depth + 1 < MAX_DEPTH) {
+      split(dots, firstChild + q, from, to, depth + 1);
+    } else {
+      nodes[firstChild + q].first = from;
+      nodes[firstChild + q].count = to - from;
+    }
+  }
+}
+
+void LooseQuadtreeBroadphase::refit(const Dots &dots) {
+  constexpr float EMPTY = std::numeric_limits<float>::infinity();
+  // children always come after their parent
+  for (size_t n = nodes.size(); n-- > 0;) {
+    Node &node = nodes[n];
+    node.reachMinX = node.reachMinY = EMPTY;
+    node.reachMaxX = node.reachMaxY = -EMPTY;
+    for (uint32_t s = node.first; s < node.first + node.count; s++) {
+      const uint32_t i = sorted[s];
+      const float r = dots.radii[i];
+      node.reachMinX = std::min(node.reachMinX, dots.positions_x[i] - r);
+      node.reachMaxX = std::max(node.reachMaxX, dots.positions_x[i] + r);
+      node.reachMinY = std::min(node.reachMinY, dots.positions_y[i] - r);
+      node.reachMaxY = std::max(node.reachMaxY, dots.positions_y[i] + r);
+    }
+    if (node.child < 0)
+      continue;
+    for (int q = 0; q < 4; q++) {
+      const Node &child = nodes[node.child + q];
+      node.reachMinX = std::min(node.reachMinX, child.reachMinX);
+      node.reachMaxX = std::max(node.reachMaxX, child.reachMaxX);
+      node.reachMinY = std::min(node.reachMinY, child.reachMinY);
+      node.reachMaxY = std::max(node.reachMaxY, child.reachMaxY);
+    }
+  }
+}
+
+void LooseQuadtreeBroadphase::findPairs(const Dots &dots,
+                                        ThreadPool *threadPool,
+                                        std::vector<CandidatePair> &pairs) {
+  PROFILE_SCOPE("broadphase_quadtree");
+  // the root is the screen, dots off it go to the nodes along the edge
+  Node root;
+  root.minX = 0.f;
+  root.minY = 0.f;
+  root.maxX = float(Settings::SCREEN_WIDTH);
+  root.maxY = float(Settings::SCREEN_HEIGHT);
+  nodes.clear();
+  nodes.push_back(root);
+
+  const size_t aliveCount = dots.alive_indices.size();
+  sorted.resize(aliveCount);
+  scratch.resize(aliveCount);
+  bucket.resize(aliveCount);
+  for (size_t k = 0; k < aliveCount; k++)
+    sorted[k] = static_cast<uint32_t>(dots.alive_indices[k]);
+  const uint32_t total = static_cast<uint32_t>(aliveCount);
+  if (total > SPLIT_COUNT)
+    split(dots, 0, 0, total, 0);
+  else
+    nodes[0].count = total;
+  refit(dots);
+
+  // every dot walks down the nodes whose reach its box touches, a pair is
+  // met from both dots so only the lower index keeps it
+  const size_t numChunks = (aliveCount + QUERY_GRAIN - 1) / QUERY_GRAIN;
+  chunkPairs.resize(numChunks);
+  threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+    uint32_t stack[MAX_DEPTH * 3 + 1];
+    for (size_t chunk = first; chunk < last; chunk++) {
+      auto &out = chunkPairs[chunk];
+      out.clear();
+      const size_t end = std::min(aliveCount, (chunk + 1) * QUERY_GRAIN);
+      for (size_t k = chunk * QUERY_GRAIN; k < end; k++) {
+        const size_t i = dots.alive_indices[k];
+        const float r = dots.radii[i];
+        const float x0 = dots.positions_x[i] - r;
+        const float x1 = dots.positions_x[i] + r;
+        const float y0 = dots.positions_y[i] - r;
+        const float y1 = dots.positions_y[i] + r;
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+          const Node &node = nodes[stack[--top]];
+          if (x1 < node.reachMinX || x0 > node.reachMaxX ||
+              y1 < node.reachMinY || y0 > node.reachMaxY)
+            continue;
+          for (uint32_t n = node.first; n < node.first + node.count; n++) {
+            const uint32_t j = sorted[n];
+            if (j > i && boxesOverlap(dots, i, j))
+              out.push_back({uint32_t(i), j});
+          }
+          if (node.child >= 0) {
+            for (int q = 3; q >= 0; q--)
+              stack[top++] = static_cast<uint32_t>(node.child + q);
+          }
+        }
+      }
+    }
+  });
+
+  joinChunks(pairs);
+}
+
+// ####################
+// ##  PAIR CACHE:   ##
+// ####################
+CachedGridBroadphase::CachedGridBroadphase() { grid.setIncremental(true); }
+
+void CachedGridBroadphase::setMargin(float newMargin) {
+  margin = newMargin;
+  invalidate();
+}
+
+void CachedGridBroadphase::findPairs(const Dots &dots, ThreadPool *threadPool,
+                                     std::vector<CandidatePair> &pairs) {
+  PROFILE_SCOPE("broadphase_cached");
+  const size_t count = dots.size();
+  const float halfMargin = margin * 0.5f;
+
+  // the cache is only complete if every dot was anchored, which needs every
+  // dot alive. Otherwise all alive dots query, and the next step again.
+  const bool allAlive = dots.alive_indices.size() == count;
+  const bool valid = allAlive && anchor_x.size() == count;
+  if (!valid) {
+    cache.clear();
+    anchor_x.assign(count, 0.f);
+    anchor_y.assign(count, 0.f);
+    anchorRadius.assign(count, 0);
+  }
+  dirty.resize(count);
+
+  // pass 1: find the dirty dots and anchor them where they are now, and
+  // the biggest anchored radius on the way
+  const size_t dotChunks = (count + DOT_GRAIN - 1) / DOT_GRAIN;
+  chunkDirty.resize(dotChunks);
+  chunkMaxRadius.resize(dotChunks);
+  threadPool->parallel_for(0, dotChunks, 1, [&](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      auto &out = chunkDirty[chunk];
+      out.clear();
+      uint8_t maxRadius = 0;
+      const size_t end = std::min(count, (chunk + 1) * DOT_GRAIN);
+      for (size_t i = chunk * DOT_GRAIN; i < end; i++) {
+        const float x = dots.positions_x[i];
+        const float y = dots.positions_y[i];
+        const bool isDirty = !valid || dots.radii[i] != anchorRadius[i] ||
+                             std::fabs(x - anchor_x[i]) > halfMargin ||
+                             std::fabs(y - anchor_y[i]) > halfMargin;
+        dirty[i] = isDirty && dots.isAlive(i);
+        if (dirty[i]) {
+          anchor_x[i] = x;
+          anchor_y[i] = y;
+          anchorRadius[i] = dots.radii[i];
+          out.push_back(static_cast<uint32_t>(i));
+        }
+        maxRadius = std::max(maxRadius, anchorRadius[i]);
+      }
+      chunkMaxRadius[chunk] = maxRadius;
+    }
+  });
+  dirtyDots.clear();
+  for (const auto &chunk : chunkDirty)
+    dirtyDots.insert(dirtyDots.end(), chunk.begin(), chunk.end());
+  const float maxRadius =
+      dotChunks > 0 ? *std::max_element(chunkMaxRadius.begin(),
+                                         chunkMaxRadius.end())
+                    : 0.f;
+
+  grid.update(dots, threadPool);
+
+  // the cached pairs first, then the queries of the dirty dots
+  const size_t pairChunks = (cache.size() + PAIR_GRAIN - 1) / PAIR_GRAIN;
+  const size_t queryChunks = (dirtyDots.size() + DOT_GRAIN - 1) / DOT_GRAIN;
+  chunkPairs.resize(pairChunks + queryChunks);
+  chunkCache.resize(pairChunks + queryChunks);
+
+  // pass 2: pairs of two clean dots stay cached, and are reported if their
+  // boxes overlap now. Pairs with a dirty dot are found again by its query.
+  threadPool->parallel_for(0, pairChunks, 1, [&](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      auto &out = chunkPairs[chunk];
+      auto &kept = chunkCache[chunk];
+      out.clear();
+      kept.clear();
+      const size_t end = std::min(cache.size(), (chunk + 1) * PAIR_GRAIN);
+      for (size_t p = chunk * PAIR_GRAIN; p < end; p++) {
+        const CandidatePair pair = cache[p];
+        if (dirty[pair.a] || dirty[pair.b])
+          continue;
+        kept.push_back(pair);
+        if (boxesOverlap(dots, pair.a, pair.b))
+          out.push_back(pair);
+      }
+    }
+  });
+
+  // pass 3: every dirty dot looks for the dots whose anchor boxes are
+  // within the margin of its own. A clean dot is at most half a margin
+  // from its anchor, so the grid is searched that much further. Two dirty
+  // dots meet twice, the lower index keeps the pair.
+  threadPool->parallel_for(0, queryChunks, 1, [&](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      auto &out = chunkPairs[pairChunks + chunk];
+      auto &found = chunkCache[pairChunks + chunk];
+      out.clear();
+      found.clear();
+      const size_t end = std::min(dirtyDots.size(), (chunk + 1) * DOT_GRAIN);
+      for (size_t d = chunk * DOT_GRAIN; d < end; d++) {
+        const uint32_t i = dirtyDots[d];
+        const float x = anchor_x[i];
+        const float y = anchor_y[i];
+        const float reach =
+            float(anchorRadius[i]) + maxRadius + margin + halfMargin;
+        // cell keys clamp both ends, dots pushed off the screen included
+        const uint32_t low = grid.cellKey(x - reach, y - reach);
+        const uint32_t high = grid.cellKey(x + reach, y + reach);
+        for (uint32_t gy = low / SpatialGrid::GRID_WIDTH;
+             gy <= high / SpatialGrid::GRID_WIDTH; gy++) {
+          for (uint32_t gx = low % SpatialGrid::GRID_WIDTH;
+               gx <= high % SpatialGrid::GRID_WIDTH; gx++) {
+            for (uint32_t j : grid.cell(gx, gy)) {
+              if (j == i || (dirty[j] && j < i))
+                continue;
+              const float cached =
+                  float(anchorRadius[i]) + float(anchorRadius[j]) + margin;
+              if (std::fabs(x - anchor_x[j]) >= cached ||
+                  std::fabs(y - anchor_y[j]) >= cached)
+                continue;
+              found.push_back(makePair(i, j));
+              if (boxesOverlap(dots, i, j))
+                out.push_back(makePair(i, j));
+            }
+          }
+        }
+      }
+    }
+  });
+
+  stats.dirtyDots = dirtyDots.size();
+  stats.cleanDots = dots.alive_indices.size() - dirtyDots.size();
+  stats.pairHits = 0;
+  for (size_t chunk = 0; chunk < pairChunks; chunk++)
+    stats.pairHits += chunkPairs[chunk].size();
+
+  joinChunks(pairs);
+  stats.pairMisses = pairs.size() - stats.pairHits;
+
+  size_t cacheSize = 0;
+  for (const auto &chunk : chunkCache)
+    cacheSize += chunk.size();
+  cache.clear();
+  if (allAlive) {
+    cache.reserve(cacheSize);
+    for (const auto &chunk : chunkCache)
+      cache.insert(cache.end(), chunk.begin(), chunk.end());
+  } else {
+    anchor_x.clear(); // dead dots were never anchored
+  }
+  stats.cachedPairs = cache.size();
+}
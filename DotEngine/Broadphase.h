@@ -0,0 +1,190 @@
+#pragma once
+#include "SpatialGrid.h"
+
+// std
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Dots;
+class ThreadPool;
+
+// two alive dots whose bounding boxes overlap, a < b
+struct CandidatePair {
+  uint32_t a;
+  uint32_t b;
+};
+
+// what the pair cache did in the last step
+struct PairCacheStats {
+  size_t cleanDots = 0;   // kept their cached pairs
+  size_t dirtyDots = 0;   // queried the grid again
+  size_t cachedPairs = 0; // pairs in the cache for the next step
+  size_t pairHits = 0;    // reported pairs that came out of the cache
+  size_t pairMisses = 0;  // reported pairs that needed a query
+};
+
+/*
+ * Finds the pairs of dots that could collide. Every backend reports the
+ * same pairs, those whose bounding boxes (center +- radius) overlap, so
+ * they can be swapped at runtime and compared on the same scene. The order
+ * of the pairs depends on the backend but not on the thread count.
+ */
+class Broadphase {
+public:
+  enum class Type {
+    Grid,          // uniform grid, cell and half stencil
+    SortAndSweep,  // sorted along x, sweep until the boxes stop overlapping
+    LooseQuadtree, // nodes split by dot count, loose x2
+    CachedGrid,    // grid, pairs within a margin are kept across steps
+  };
+
+  static std::unique_ptr<Broadphase> create(Type type);
+  static const char *typeName(Type type);
+
+  virtual ~Broadphase() = default;
+  virtual Type type() const = 0;
+
+  /*
+   * Rebuilds the structure from the alive dots and writes every candidate
+   * pair
+   *
+   * @param dots The dots, only alive_indices are looked at
+   * @param threadPool The pool to split the work over
+   * @param pairs Output, cleared first
+   */
+  virtual void findPairs(const Dots &dots, ThreadPool *threadPool,
+                         std::vector<CandidatePair> &pairs) = 0;
+  /// The dots changed index (reorder), drop anything kept between steps
+  virtual void invalidate() {}
+
+protected:
+  // every chunk writes its own pairs, they are joined in chunk order
+  void joinChunks(std::vector<CandidatePair> &pairs);
+
+  std::vector<std::vector<CandidatePair>> chunkPairs;
+};
+
+class GridBroadphase : public Broadphase {
+public:
+  Type type() const override { return Type::Grid; }
+  void findPairs(const Dots &dots, ThreadPool *threadPool,
+                 std::vector<CandidatePair> &pairs) override;
+
+private:
+  SpatialGrid grid;
+};
+
+class SortAndSweepBroadphase : public Broadphase {
+public:
+  static constexpr size_t SWEEP_GRAIN = 2048; // sorted dots per chunk
+
+  Type type() const override { return Type::SortAndSweep; }
+  void findPairs(const Dots &dots, ThreadPool *threadPool,
+                 std::vector<CandidatePair> &pairs) override;
+
+private:
+  // counting sort on the pixel column of the left edge, a dot is only
+  // compared with the dots after it
+  std::vector<uint32_t> columnStart;
+  std::vector<uint32_t> sorted;
+  std::vector<uint32_t> column; // per sorted slot, the sweep reads linearly
+  std::vector<uint32_t> dotColumn; // per alive dot, scratch
+};
+
+/*
+ * Quadtree over the screen whose nodes split once they hold more than
+ * SPLIT_COUNT dots, so dense clusters get small nodes and empty space stays
+ * one big node. Loose: a node may hold any dot whose center is inside it and
+ * whose radius is at most a quarter of the node, its box then stays within
+ * the node grown by half its size on every side. A dot goes into the
+ * deepest node that can hold it.
+ *
+ * The queries don't use those loose bounds but the boxes the nodes really
+ * hold, refit after every build. The dots are much smaller than the nodes,
+ * so that prunes most of the tree.
+ */
+class LooseQuadtreeBroadphase : public Broadphase {
+public:
+  static constexpr int MAX_DEPTH = 10;        // ~1.9 x 1.1 px at the bottom
+  static constexpr uint32_t SPLIT_COUNT = 16; // dots a leaf holds at most
+  static constexpr size_t QUERY_GRAIN = 2048; // dots per query chunk
+
+  Type type() const override { return Type::LooseQuadtree; }
+  void findPairs(const Dots &dots, ThreadPool *threadPool,
+                 std::vector<CandidatePair> &pairs) override;
+
+private:
+  struct Node {
+    float minX, minY, maxX, maxY;
+    // the boxes of every dot below it, dots pushed off the screen included
+    float reachMinX, reachMinY, reachMaxX, reachMaxY;
+    uint32_t first = 0; // its own dots are sorted[first, first + count)
+    uint32_t count = 0;
+    int32_t child = -1; // first of the 4 children, -1 for a leaf
+  };
+
+  /// Sorts the dots of node into its own ones and the 4 quadrants
+  void split(const Dots &dots, uint32_t node, uint32_t begin, uint32_t end,
+             int depth);
+  /// Works out the reach of every node, children first
+  void refit(const Dots &dots);
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> sorted;  // alive dots, grouped by node
+  std::vector<uint32_t> scratch; // counting sort target
+  std::vector<uint8_t> bucket;   // per sorted slot, 0 own, 1-4 quadrant
+};
+
+/*
+ * Grid broadphase that keeps the pairs of the last steps, a Verlet list.
+ * Every dot has an anchor, where it was when its pairs were gathered, and
+ * the cache holds every pair whose boxes at the anchors were closer than
+ * the margin. A dot that stayed within half the margin of its anchor, with
+ * the same radius, is clean: two clean dots can't have started to overlap
+ * without being in the cache, so their pairs are only checked again. Only
+ * dirty dots query the grid, which is kept incrementally, and are anchored
+ * where they are now.
+ *
+ * Dense, slow clusters keep most dots clean. Dots that collide grow and
+ * get pushed, so they are dirty the step after either way.
+ */
+class CachedGridBroadphase : public Broadphase {
+public:
+  static constexpr float DEFAULT_MARGIN = 4.f; // px
+  static constexpr size_t DOT_GRAIN = 4096;    // dots per chunk
+  static constexpr size_t PAIR_GRAIN = 16384;  // cached pairs per chunk
+
+  CachedGridBroadphase();
+  Type type() const override { return Type::CachedGrid; }
+  void findPairs(const Dots &dots, ThreadPool *threadPool,
+                 std::vector<CandidatePair> &pairs) override;
+  void invalidate() override { anchor_x.clear(); }
+
+  /*
+   * Sets how far apart dots may be and still be cached. A wider margin
+   * keeps dots clean longer but caches more pairs. Drops the cache.
+   *
+   * @param newMargin The margin in px
+   */
+  void setMargin(float newMargin);
+  float getMargin() const { return margin; }
+  const PairCacheStats &getStats() const { return stats; }
+
+private:
+  float margin = DEFAULT_MARGIN;
+  PairCacheStats stats;
+  SpatialGrid grid; // incremental, current positions
+
+  // per dot index
+  std::vector<float> anchor_x;
+  std::vector<float> anchor_y;
+  std::vector<uint8_t> anchorRadius;
+  std::vector<uint8_t> dirty;
+
+  std::vector<CandidatePair> cache;
+  std::vector<std::vector<uint32_t>> chunkDirty; // dirty dots per chunk
+  std::vector<uint8_t> chunkMaxRadius;
+  std::vector<uint32_t> dirtyDots;
+  std::vector<std::vector<CandidatePair>> chunkCache; // next cache per chunk
+};
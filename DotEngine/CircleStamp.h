@@ -0,0 +1,91 @@
+#pragma once
+#include "Dots.h"
+
+// std
+#include <array>
+#include <cstdint>
+#include <emmintrin.h>
+
+/// ARGB color of a dot, the red channel goes up as it grows
+constexpr uint32_t dotColor(int radius) {
+  // wraps around past 255, that's what the dots always looked like
+  const uint8_t red = static_cast<uint8_t>(
+      static_cast<int>((radius - Dots::RADIUS) * 0.5f * 255.f * 4.f));
+  return (255u << 24) | (uint32_t(red) << 16) | (125u << 8) | 125u;
+}
+
+/*
+ * A dot of radius R, worked out at compile time. Row dy of the circle
+ * covers the pixels [-halfWidth, halfWidth] around the center, the same
+ * pixels the old span cache had.
+ *
+ * The bounding box is split into 4 pixel blocks per row, and every block
+ * holds the dot color in the lanes inside the circle and 0 outside. Adding
+ * a block with saturation leaves the outside pixels as they were, so a
+ * whole dot is a fixed list of load, add, store, without any span lengths
+ * or tail loops.
+ */
+template <int R> struct CircleStamp {
+  static_assert(R >= 0, "no negative radii");
+
+  static constexpr int ROWS = 2 * R + 1;
+  static constexpr int BLOCKS = (2 * R + 1 + 3) / 4; // 4 pixel blocks per row
+  // pixels read past the right edge of the bounding box, the buffer needs
+  // that many more pixels after its last row
+  static constexpr int OVERHANG = BLOCKS * 4 - (2 * R + 1);
+  static constexpr uint32_t COLOR = dotColor(R);
+
+  /// Half width of every row, from dy = -R down to dy = R
+  static constexpr std::array<int, ROWS> halfWidths = [] {
+    std::array<int, ROWS> widths{};
+    for (int dy = -R; dy <= R; dy++) {
+      int half = 0;
+      while ((half + 1) * (half + 1) + dy * dy <= R * R)
+        half++;
+      widths[dy + R] = half;
+    }
+    return widths;
+  }();
+
+  struct Blocks {
+    alignas(16) uint32_t pixels[ROWS][BLOCKS][4];
+    bool used[ROWS][BLOCKS]; // false if the block adds nothing
+  };
+  static constexpr Blocks blocks = [] {
+    Blocks b{};
+    for (int row = 0; row < ROWS; row++) {
+      for (int block = 0; block < BLOCKS; block++) {
+        for (int lane = 0; lane < 4; lane++) {
+          const int dx = block * 4 + lane - R;
+          const bool inside =
+              -halfWidths[row] <= dx && dx <= halfWidths[row];
+          b.pixels[row][block][lane] = inside ? COLOR : 0;
+          b.used[row][block] = b.used[row][block] || inside;
+        }
+      }
+    }
+    return b;
+  }();
+
+  /*
+   * Adds the dot to the buffer. The bounding box has to be inside the
+   * buffer, plus OVERHANG pixels after it on the same row (they can spill
+   * into the next row, they are written back unchanged).
+   *
+   * @param corner The top left pixel of the bounding box, (x - R, y - R)
+   * @param pitch Pixels per row of the buffer
+   */
+  static void blend(uint32_t *corner, int pitch) {
+    for (int row = 0; row < ROWS; row++) {
+      uint32_t *line = corner + row * pitch;
+      for (int block = 0; block < BLOCKS; block++) {
+        if (!blocks.used[row][block])
+          continue;
+        __m128i *dst = reinterpret_cast<__m128i *>(line + block * 4);
+        const __m128i src = _mm_load_si128(
+            reinterpret_cast<const __m128i *>(blocks.pixels[row][block]));
+        _mm_storeu_si128(dst, _mm_adds_epu8(_mm_loadu_si128(dst), src));
+      }
+    }
+  }
+};
@@ -0,0 +1,328 @@
+#include "CompactDots.h"
+#include "MortonOrder.h"
+#include "NarrowPhase.h"
+#include "ScopeProfiler.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+namespace {
+// lrint rounds half to even, the same as the SIMD conversions
+uint16_t quantizePosition(float position) {
+  return static_cast<uint16_t>(
+      std::clamp(std::lrint(position * CompactDots::POSITION_SCALE), 0l,
+                 long(UINT16_MAX)));
+}
+
+int8_t quantizeDirection(float direction) {
+  return static_cast<int8_t>(
+      std::clamp(std::lrint(direction * CompactDots::DIRECTION_SCALE), -127l,
+                 127l));
+}
+
+// the low 4 fixed point positions of a vector as pixels
+__m128 toPixels(__m128i fixed, __m128 scale) {
+  return _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(fixed)), scale);
+}
+} // namespace
+
+void CompactDots::resize(size_t newCount) {
+  positions_x.resize(newCount);
+  positions_y.resize(newCount);
+  directions_x.resize(newCount);
+  directions_y.resize(newCount);
+  states.resize(newCount);
+  count = newCount;
+}
+
+void CompactDots::pack(const Dots &dots) {
+  resize(dots.size());
+  for (size_t i = 0; i < count; i++)
+    packDot(dots, i);
+}
+
+void CompactDots::packDot(const Dots &dots, size_t index) {
+  positions_x[index] = quantizePosition(dots.positions_x[index]);
+  positions_y[index] = quantizePosition(dots.positions_y[index]);
+  directions_x[index] = quantizeDirection(dots.velocities_x[index]);
+  directions_y[index] = quantizeDirection(dots.velocities_y[index]);
+  states[index] = static_cast<uint8_t>(
+      (dots.radii[index] & RADIUS_MASK) | (dots.isAlive(index) ? ALIVE_BIT : 0));
+}
+
+void CompactDots::unpack(Dots &dots) const {
+  if (dots.size() != count)
+    dots.resize(count);
+  unpackPositions(dots.positions_x.data(), dots.positions_y.data());
+  unpackRadii(dots.radii.data());
+  for (size_t i = 0; i < count; i++) {
+    dots.velocities_x[i] = directions_x[i] / DIRECTION_SCALE;
+    dots.velocities_y[i] = directions_y[i] / DIRECTION_SCALE;
+    dots.alive[i] = isAlive(i);
+  }
+}
+
+void CompactDots::unpackPositions(float *out_x, float *out_y) const {
+  const __m128 v_scale = _mm_set1_ps(1.f / POSITION_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    // 8 positions, uint16 -> int32 -> float, low and high half
+    __m128i px =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&positions_x[i]));
+    __m128i py =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&positions_y[i]));
+    _mm_storeu_ps(out_x + i, toPixels(px, v_scale));
+    _mm_storeu_ps(out_x + i + 4, toPixels(_mm_srli_si128(px, 8), v_scale));
+    _mm_storeu_ps(out_y + i, toPixels(py, v_scale));
+    _mm_storeu_ps(out_y + i + 4, toPixels(_mm_srli_si128(py, 8), v_scale));
+  }
+  // leftovers
+  for (; i < count; i++) {
+    out_x[i] = x(i);
+    out_y[i] = y(i);
+  }
+}
+
+void CompactDots::unpackRadii(uint8_t *out) const {
+  const __m128i v_mask = _mm_set1_epi8(RADIUS_MASK);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&states[i]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_and_si128(s, v_mask));
+  }
+  for (; i < count; i++)
+    out[i] = radius(i);
+}
+
+void CompactDots::sortByMorton(MortonOrder &mortonOrder,
+                               ThreadPool *threadPool) {
+  PROFILE_SCOPE("compact_reorder");
+  mortonOrder.sort(
+      count,
+      [this](size_t i) {
+        return isAlive(i) ? MortonOrder::key(x(i), y(i))
+                          : MortonOrder::DEAD_KEY;
+      },
+      threadPool);
+  mortonOrder.apply(positions_x, threadPool);
+  mortonOrder.apply(positions_y, threadPool);
+  mortonOrder.apply(directions_x, threadPool);
+  mortonOrder.apply(directions_y, threadPool);
+  mortonOrder.apply(states, threadPool);
+}
+
+void CompactDots::updateAll(float deltaTime, ThreadPool *threadPool) {
+  PROFILE_SCOPE("dots_update");
+  threadPool->parallel_for(0, count, Dots::UPDATE_GRAIN,
+                           [this, deltaTime](size_t begin, size_t end) {
+                             updateRange(begin, end, deltaTime);
+                           });
+}
+
+void CompactDots::updateRange(size_t begin, size_t end, float deltaTime) {
+  PROFILE_SCOPE("update_range");
+  const float step = Dots::VELOCITY * deltaTime;
+  size_t i = Simd::active() >= Simd::Level::AVX2
+                 ? updateRangeAVX2(begin, end, step)
+                 : updateRangeSSE4(begin, end, step);
+
+  // leftovers
+  for (; i < end; i++) {
+    const float r = radius(i);
+    float px = x(i) + directions_x[i] * (step / DIRECTION_SCALE);
+    float py = y(i) + directions_y[i] * (step / DIRECTION_SCALE);
+
+    // X-Axis bounds check
+    if (px - r < 0.0f) {
+      px = r;
+      directions_x[i] = -directions_x[i];
+    } else if (px + r > Settings::SCREEN_WIDTH) {
+      px = Settings::SCREEN_WIDTH - r;
+      directions_x[i] = -directions_x[i];
+    }
+
+    // Y-Axis bounds check
+    if (py - r < 0.0f) {
+      py = r;
+      directions_y[i] = -directions_y[i];
+    } else if (py + r > Settings::SCREEN_HEIGHT) {
+      py = Settings::SCREEN_HEIGHT - r;
+      directions_y[i] = -directions_y[i];
+    }
+
+    positions_x[i] = quantizePosition(px);
+    positions_y[i] = quantizePosition(py);
+  }
+}
+
+SIMD_TARGET("avx2")
+size_t CompactDots::updateRangeAVX2(size_t begin, size_t end, float step) {
+  size_t i = begin;
+  // fixed point -> pixels, and the velocity folds in the int8 scale
+  const __m256 v_toPixels = _mm256_set1_ps(1.f / POSITION_SCALE);
+  const __m256 v_toFixed = _mm256_set1_ps(POSITION_SCALE);
+  const __m256 v_step = _mm256_set1_ps(step / DIRECTION_SCALE);
+  const __m256 v_zero = _mm256_setzero_ps();
+  const __m256 v_width = _mm256_set1_ps(float(Settings::SCREEN_WIDTH));
+  const __m256 v_height = _mm256_set1_ps(float(Settings::SCREEN_HEIGHT));
+  const __m256i v_radiusMask = _mm256_set1_epi32(RADIUS_MASK);
+  const __m256i v_one = _mm256_set1_epi32(1);
+
+  for (; i + 8 <= end; i += 8) {
+    // 8 dots, every field widened to 32 bit lanes
+    __m256 px = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(&positions_x[i])))),
+        v_toPixels);
+    __m256 py = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(&positions_y[i])))),
+        v_toPixels);
+    __m256i dx = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&directions_x[i])));
+    __m256i dy = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&directions_y[i])));
+    __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(
+        _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&states[i]))),
+        v_radiusMask));
+
+    px = _mm256_add_ps(px, _mm256_mul_ps(_mm256_cvtepi32_ps(dx), v_step));
+    py = _mm256_add_ps(py, _mm256_mul_ps(_mm256_cvtepi32_ps(dy), v_step));
+
+    // X-Axis bounds check, clamp into the screen and flip the direction,
+    // the int8 direction negates exactly
+    __m256 lowX = _mm256_cmp_ps(_mm256_sub_ps(px, r), v_zero, _CMP_LT_OQ);
+    __m256 highX = _mm256_cmp_ps(_mm256_add_ps(px, r), v_width, _CMP_GT_OQ);
+    px = _mm256_blendv_ps(px, r, lowX);
+    px = _mm256_blendv_ps(px, _mm256_sub_ps(v_width, r), highX);
+    __m256i flipX = _mm256_castps_si256(_mm256_or_ps(lowX, highX));
+    dx = _mm256_sign_epi32(dx, _mm256_or_si256(flipX, v_one));
+
+    // Y-Axis bounds check
+    __m256 lowY = _mm256_cmp_ps(_mm256_sub_ps(py, r), v_zero, _CMP_LT_OQ);
+    __m256 highY = _mm256_cmp_ps(_mm256_add_ps(py, r), v_height, _CMP_GT_OQ);
+    py = _mm256_blendv_ps(py, r, lowY);
+    py = _mm256_blendv_ps(py, _mm256_sub_ps(v_height, r), highY);
+    __m256i flipY = _mm256_castps_si256(_mm256_or_ps(lowY, highY));
+    dy = _mm256_sign_epi32(dy, _mm256_or_si256(flipY, v_one));
+
+    // pack again, packus saturates positions into the uint16 range
+    __m256i fx = _mm256_cvtps_epi32(_mm256_mul_ps(px, v_toFixed));
+    __m256i fy = _mm256_cvtps_epi32(_mm256_mul_ps(py, v_toFixed));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&positions_x[i]),
+                     _mm_packus_epi32(_mm256_castsi256_si128(fx),
+                                      _mm256_extracti128_si256(fx, 1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&positions_y[i]),
+                     _mm_packus_epi32(_mm256_castsi256_si128(fy),
+                                      _mm256_extracti128_si256(fy, 1)));
+    __m128i dx16 = _mm_packs_epi32(_mm256_castsi256_si128(dx),
+                                   _mm256_extracti128_si256(dx, 1));
+    __m128i dy16 = _mm_packs_epi32(_mm256_castsi256_si128(dy),
+                                   _mm256_extracti128_si256(dy, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&directions_x[i]),
+                     _mm_packs_epi16(dx16, dx16));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&directions_y[i]),
+                     _mm_packs_epi16(dy16, dy16));
+  }
+  return i;
+}
+
+size_t CompactDots::updateRangeSSE4(size_t begin, size_t end, float step) {
+  size_t i = begin;
+  const __m128 v_toPixels = _mm_set1_ps(1.f / POSITION_SCALE);
+  const __m128 v_toFixed = _mm_set1_ps(POSITION_SCALE);
+  const __m128 v_step = _mm_set1_ps(step / DIRECTION_SCALE);
+  const __m128 v_zero = _mm_setzero_ps();
+  const __m128 v_width = _mm_set1_ps(float(Settings::SCREEN_WIDTH));
+  const __m128 v_height = _mm_set1_ps(float(Settings::SCREEN_HEIGHT));
+  const __m128i v_radiusMask = _mm_set1_epi32(RADIUS_MASK);
+  const __m128i v_one = _mm_set1_epi32(1);
+
+  for (; i + 4 <= end; i += 4) {
+    // 4 dots, every field widened to 32 bit lanes
+    int packedX, packedY, packedStates;
+    memcpy(&packedX, &directions_x[i], sizeof(packedX));
+    memcpy(&packedY, &directions_y[i], sizeof(packedY));
+    memcpy(&packedStates, &states[i], sizeof(packedStates));
+    __m128 px = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(&positions_x[i])))),
+        v_toPixels);
+    __m128 py = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(&positions_y[i])))),
+        v_toPixels);
+    __m128i dx = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(packedX));
+    __m128i dy = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(packedY));
+    __m128 r = _mm_cvtepi32_ps(_mm_and_si128(
+        _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packedStates)), v_radiusMask));
+
+    px = _mm_add_ps(px, _mm_mul_ps(_mm_cvtepi32_ps(dx), v_step));
+    py = _mm_add_ps(py, _mm_mul_ps(_mm_cvtepi32_ps(dy), v_step));
+
+    // X-Axis bounds check, clamp into the screen and flip the direction
+    __m128 lowX = _mm_cmplt_ps(_mm_sub_ps(px, r), v_zero);
+    __m128 highX = _mm_cmpgt_ps(_mm_add_ps(px, r), v_width);
+    px = _mm_blendv_ps(px, r, lowX);
+    px = _mm_blendv_ps(px, _mm_sub_ps(v_width, r), highX);
+    dx = _mm_sign_epi32(
+        dx, _mm_or_si128(_mm_castps_si128(_mm_or_ps(lowX, highX)), v_one));
+
+    // Y-Axis bounds check
+    __m128 lowY = _mm_cmplt_ps(_mm_sub_ps(py, r), v_zero);
+    __m128 highY = _mm_cmpgt_ps(_mm_add_ps(py, r), v_height);
+    py = _mm_blendv_ps(py, r, lowY);
+    py = _mm_blendv_ps(py, _mm_sub_ps(v_height, r), highY);
+    dy = _mm_sign_epi32(
+        dy, _mm_or_si128(_mm_castps_si128(_mm_or_ps(lowY, highY)), v_one));
+
+    // pack again, packus saturates positions into the uint16 range
+    __m128i fx = _mm_cvtps_epi32(_mm_mul_ps(px, v_toFixed));
+    __m128i fy = _mm_cvtps_epi32(_mm_mul_ps(py, v_toFixed));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&positions_x[i]),
+                     _mm_packus_epi32(fx, fx));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(&positions_y[i]),
+                     _mm_packus_epi32(fy, fy));
+    __m128i dx16 = _mm_packs_epi32(dx, dx);
+    __m128i dy16 = _mm_packs_epi32(dy, dy);
+    packedX = _mm_cvtsi128_si32(_mm_packs_epi16(dx16, dx16));
+    packedY = _mm_cvtsi128_si32(_mm_packs_epi16(dy16, dy16));
+    memcpy(&directions_x[i], &packedX, sizeof(packedX));
+    memcpy(&directions_y[i], &packedY, sizeof(packedY));
+  }
+  return i;
+}
+
+void CompactDots::collide(size_t i1, size_t i2) {
+  ContactPair pair = {x(i1),
+                      y(i1),
+                      x(i2),
+                      y(i2),
+                      directions_x[i1] / DIRECTION_SCALE,
+                      directions_y[i1] / DIRECTION_SCALE,
+                      directions_x[i2] / DIRECTION_SCALE,
+                      directions_y[i2] / DIRECTION_SCALE};
+  float minDist = radius(i1) + radius(i2);
+  if (!NarrowPhase::touching(pair, minDist))
+    return;
+
+  NarrowPhase::respond(pair, minDist);
+  positions_x[i1] = quantizePosition(pair.x1);
+  positions_y[i1] = quantizePosition(pair.y1);
+  positions_x[i2] = quantizePosition(pair.x2);
+  positions_y[i2] = quantizePosition(pair.y2);
+  directions_x[i1] = quantizeDirection(pair.vx1);
+  directions_y[i1] = quantizeDirection(pair.vy1);
+  directions_x[i2] = quantizeDirection(pair.vx2);
+  directions_y[i2] = quantizeDirection(pair.vy2);
+
+  grow(i1);
+  grow(i2);
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "AlignedArray.h"
+#include "Dots.h"
+#include "Settings.h"
+#include <cstdint>
+
+class MortonOrder;
+class ThreadPool;
+
+/*
+ * Quantized layout of the dots, 7 bytes per dot instead of 18:
+ *  - positions are 16 bit fixed point with POSITION_FRACTION_BITS fraction
+ *    bits (1/32 px),
+ *  - the direction is a unit vector in int8, the speed is always
+ *    Dots::VELOCITY so it is not stored,
+ *  - radius and alive flag share one state byte.
+ * The kernels unpack into float registers, run the same math as the float
+ * layout and pack the results again. Positions saturate at the edges of the
+ * fixed point range, which only ever clips dots pushed off the screen.
+ */
+class CompactDots {
+public:
+  static constexpr int POSITION_FRACTION_BITS = 5;
+  static constexpr float POSITION_SCALE = float(1 << POSITION_FRACTION_BITS);
+  static constexpr float DIRECTION_SCALE = 127.f;
+  static constexpr uint8_t RADIUS_MASK = 0x0F;
+  static constexpr uint8_t ALIVE_BIT = 0x80;
+  static constexpr size_t BYTES_PER_DOT = 2 * sizeof(uint16_t) +
+                                          2 * sizeof(int8_t) + sizeof(uint8_t);
+
+  static_assert(Settings::SCREEN_WIDTH * POSITION_SCALE <= UINT16_MAX &&
+                    Settings::SCREEN_HEIGHT * POSITION_SCALE <= UINT16_MAX,
+                "the screen does not fit the fixed point positions");
+  static_assert(Dots::DEATH_RADIUS <= RADIUS_MASK,
+                "the radius does not fit the state byte");
+
+  size_t size() const { return count; }
+  void resize(size_t count);
+
+  /// Quantizes every dot, the alive flags included
+  void pack(const Dots &dots);
+  void packDot(const Dots &dots, size_t index);
+  /// Writes every dot back into the float layout
+  void unpack(Dots &dots) const;
+
+  float x(size_t index) const { return positions_x[index] / POSITION_SCALE; }
+  float y(size_t index) const { return positions_y[index] / POSITION_SCALE; }
+  uint8_t radius(size_t index) const { return states[index] & RADIUS_MASK; }
+  bool isAlive(size_t index) const { return states[index] & ALIVE_BIT; }
+
+  /// Same as Dots::grow, the dot dies at Dots::DEATH_RADIUS
+  void grow(size_t index) {
+    uint8_t radius = (states[index] & RADIUS_MASK) + 1;
+    states[index] = radius >= Dots::DEATH_RADIUS
+                        ? radius
+                        : static_cast<uint8_t>(radius | ALIVE_BIT);
+  }
+
+  /*
+   * Unpacks all positions into float arrays, 8 dots at a time
+   *
+   * @param out_x, out_y Arrays with room for size() floats
+   */
+  void unpackPositions(float *out_x, float *out_y) const;
+  void unpackRadii(uint8_t *out) const;
+
+  /*
+   * Same as Dots::updateAll on the quantized arrays
+   *
+   * @param deltaTime deltaTime
+   * @param threadPool The pool to split the chunks over
+   */
+  void updateAll(float deltaTime, ThreadPool *threadPool);
+  void updateRange(size_t begin, size_t end, float deltaTime);
+
+  /*
+   * Same as Dots::sortByMorton, but the alive set lives in Dots, so the
+   * caller rebuilds it from the moved states.
+   *
+   * @param mortonOrder The sorter, keeps the order for other arrays
+   * @param threadPool The pool to split the work over
+   */
+  void sortByMorton(MortonOrder &mortonOrder, ThreadPool *threadPool);
+
+  /*
+   * Collision response of two dots, the same as Game::collideDotsUnlocked.
+   * The caller has to own both dots.
+   *
+   * @param i1 Index of first dot
+   * @param i2 Index of other dot
+   */
+  void collide(size_t i1, size_t i2);
+
+private:
+  size_t count = 0;
+  /// Vector part of updateRange, returns the first dot it left for the
+  /// scalar leftovers
+  size_t updateRangeAVX2(size_t begin, size_t end, float step);
+  size_t updateRangeSSE4(size_t begin, size_t end, float step);
+
+public:
+  AlignedArray<uint16_t> positions_x; // 2B
+  AlignedArray<uint16_t> positions_y; // 2B
+  AlignedArray<int8_t> directions_x;  // 1B
+  AlignedArray<int8_t> directions_y;  // 1B
+  AlignedArray<uint8_t> states;       // 1B, radius | ALIVE_BIT
+};
@@ -4,6 +4,7 @@
 #include <SDL3_ttf/SDL_ttf.h>
 
 // std
+#include <algorithm>
 #include <iostream>
 
 Debug* Debug::Instance{nullptr};
@@ -19,6 +20,62 @@ Debug::Debug(DotRenderer *renderer, TTF_Font *font)
     Instance = this;
     Log("[DEBUG] Set Instance");
   }
+
+  if(_renderer != nullptr && m_font != nullptr)
+    BuildGlyphAtlas();
+}
+
+void Debug::BuildGlyphAtlas(){
+  const SDL_Color white = {255, 255, 255, 255};
+  const int glyphCount = LAST_GLYPH - FIRST_GLYPH + 1;
+
+  // render every glyph first, the atlas is one row as wide as all of them
+  std::vector<SDL_Surface*> surfaces(glyphCount, nullptr);
+  int width = 0;
+  int height = TTF_GetFontHeight(m_font);
+  for(int i=0; i<glyphCount; ++i){
+    surfaces[i] = TTF_RenderGlyph_Blended(m_font, FIRST_GLYPH + i, white);
+    if(surfaces[i] == nullptr)
+      continue;
+    width += surfaces[i]->w + 1; // one pixel gap against bleeding
+    height = std::max(height, surfaces[i]->h);
+  }
+
+  SDL_Surface *atlas = width > 0
+      ? SDL_CreateSurface(width, height, SDL_PIXELFORMAT_ARGB8888)
+      : nullptr;
+  if(atlas == nullptr){
+    LogError("[DEBUG] Could not create the glyph atlas");
+    for(SDL_Surface *surface : surfaces)
+      SDL_DestroySurface(surface);
+    return;
+  }
+
+  int x = 0;
+  for(int i=0; i<glyphCount; ++i){
+    int advance = 0;
+    TTF_GetGlyphMetrics(m_font, FIRST_GLYPH + i, nullptr, nullptr, nullptr,
+                        nullptr, &advance);
+    m_glyphs[i] = {float(x), 0.f, float(advance)};
+
+    SDL_Surface *glyph = surfaces[i];
+    if(glyph == nullptr)
+      continue;
+    // copy the alpha as is, the atlas starts out fully transparent
+    SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+    SDL_Rect dst = {x, 0, glyph->w, glyph->h};
+    SDL_BlitSurface(glyph, nullptr, atlas, &dst);
+    m_glyphs[i].w = float(glyph->w);
+    x += glyph->w + 1;
+    SDL_DestroySurface(glyph);
+  }
+
+  m_atlas = SDL_CreateTextureFromSurface(_renderer->GetSDLRenderer(), atlas);
+  if(m_atlas != nullptr)
+    SDL_SetTextureBlendMode(m_atlas, SDL_BLENDMODE_BLEND);
+  m_atlasWidth = float(atlas->w);
+  m_atlasHeight = float(atlas->h);
+  SDL_DestroySurface(atlas);
 }
 
 void Debug::DeleteInstance(){
@@ -28,21 +85,65 @@ void Debug::DeleteInstance(){
 }
 
 Debug::~Debug(){
-  for(const auto& item_kvp : textDebugInfoMap){
-    SDL_DestroyTexture(item_kvp.second.texture);
-  } 
+  if(m_atlas != nullptr)
+    SDL_DestroyTexture(m_atlas);
 }
 
 // screen logging
 void Debug::Render() {
+  if(_renderer == nullptr || m_atlas == nullptr)
+    return;
+
+  if(m_quadsDirty)
+    RebuildQuads();
+  if(m_indices.empty())
+    return;
+
+  SDL_RenderGeometry(_renderer->GetSDLRenderer(), m_atlas, m_vertices.data(),
+                     (int)m_vertices.size(), m_indices.data(),
+                     (int)m_indices.size());
+}
+
+void Debug::RebuildQuads(){
+  m_vertices.clear();
+  m_indices.clear();
+
   const float TextSpacing = 10.f;
   float incrementalHeight = 0.f;
-  for(int i=0; i<keysOrder.size(); ++i){
-    auto& item = textDebugInfoMap[keysOrder[i]];
-    SDL_FRect renderQuad = {0, incrementalHeight, (float)item.w,
-      (float)item.h};
-    _renderer->RenderTexture(item.texture, nullptr, &renderQuad);
-    incrementalHeight += (float)item.h + TextSpacing;
+  for(const std::string &key : keysOrder){
+    SDL_Color textColor = {255, 255, 255, 255};
+    auto settings = keySettingsMap.find(key);
+    if(settings != keySettingsMap.end())
+      textColor = settings->second.textColor;
+
+    PushText(debugValuesMap[key], incrementalHeight, textColor);
+    incrementalHeight += m_atlasHeight + TextSpacing;
+  }
+  m_quadsDirty = false;
+}
+
+void Debug::PushText(const std::string &text, float y, SDL_Color color){
+  const SDL_FColor tint = {color.r / 255.f, color.g / 255.f, color.b / 255.f,
+                           color.a / 255.f};
+  float x = 0.f;
+  for(char c : text){
+    // anything outside the atlas is drawn as a question mark
+    int glyphIndex = (c >= FIRST_GLYPH && c <= LAST_GLYPH) ? c : '?';
+    const DebugGlyph &glyph = m_glyphs[glyphIndex - FIRST_GLYPH];
+
+    // spaces and friends only move the pen
+    if(glyph.w > 0.f){
+      const float u0 = glyph.x / m_atlasWidth;
+      const float u1 = (glyph.x + glyph.w) / m_atlasWidth;
+      const int first = (int)m_vertices.size();
+      m_vertices.push_back({{x, y}, tint, {u0, 0.f}});
+      m_vertices.push_back({{x + glyph.w, y}, tint, {u1, 0.f}});
+      m_vertices.push_back({{x + glyph.w, y + m_atlasHeight}, tint, {u1, 1.f}});
+      m_vertices.push_back({{x, y + m_atlasHeight}, tint, {u0, 1.f}});
+      for(int corner : {0, 1, 2, 0, 2, 3})
+        m_indices.push_back(first + corner);
+    }
+    x += glyph.advance;
   }
 }
 
@@ -70,29 +171,15 @@ void Debug::UpdateScreenField(std::string key, std::string value) {
     Instance->keysOrder.push_back(key);
   }
 
-  // update the texture
-  SDL_Color textColor = {255, 255, 255, 255};
-  if(Instance->keySettingsMap.contains(key)){
-    textColor = Instance->keySettingsMap[key].textColor;
-  }
-
-
-  SDL_Surface *textSurface =
-      TTF_RenderText_Solid(Instance->m_font, value.c_str(), 0, textColor);
-  if (textSurface != nullptr) {
-    SDL_Texture *textTexture =
-        SDL_CreateTextureFromSurface(Instance->_renderer->GetSDLRenderer(), textSurface);
-    // update text info map
-    Instance->textDebugInfoMap[key] = {textTexture, textSurface->w, textSurface->h};
-  }
-  // TODO: delete surface
-  SDL_DestroySurface(textSurface);
+  // the quads are made again on the next Render, no textures per value
+  Instance->m_quadsDirty = true;
 }
 
 void Debug::UpdateKeySettings(std::string key, KeySettings settings){
   if(Instance == nullptr)
     return;
   Instance->keySettingsMap[key] = settings;
+  Instance->m_quadsDirty = true;
 }
 
 void Debug::OutputScreenFields(){
@@ -3,6 +3,7 @@
 #include <unordered_map>
 #include <vector>
 #include "SDL3/SDL_pixels.h"
+#include "SDL3/SDL_render.h"
 
 #define DEBUG_MODE_ON
 
@@ -15,20 +16,30 @@ struct KeySettings{
   SDL_Color textColor;
 };
 
-struct DebugTextInfoItem{
-  SDL_Texture* texture;
-  int w;
-  int h;
+// where a glyph sits in the atlas, in pixels
+struct DebugGlyph{
+  float x;
+  float w;
+  float advance;
 };
 
 // TODO: implement a save file for logs? unecessary for now
 class Debug {
 public:
+  /*
+   * Creates the debug instance. Passing a nullptr renderer and font only
+   * keeps the screen field values, which is what headless runs use.
+   */
   Debug(DotRenderer *renderer, TTF_Font* font);
   static Debug* GetInstance();
   static void DeleteInstance();
 
   ~Debug();
+  /*
+   * Draws every screen field as quads from the glyph atlas, all fields in a
+   * single SDL_RenderGeometry call. The quads are only rebuilt when a value
+   * has changed.
+   */
   void Render();
 
 private:
@@ -36,6 +47,23 @@ private:
   DotRenderer *_renderer;
   TTF_Font* m_font;
 
+  // printable ascii, rendered once in white and tinted by the vertex color
+  static constexpr int FIRST_GLYPH = 32;
+  static constexpr int LAST_GLYPH = 126;
+  SDL_Texture* m_atlas = nullptr;
+  float m_atlasWidth = 0.f;
+  float m_atlasHeight = 0.f;
+  DebugGlyph m_glyphs[LAST_GLYPH - FIRST_GLYPH + 1] = {};
+
+  /// Renders every glyph of the font into one texture
+  void BuildGlyphAtlas();
+  void RebuildQuads();
+  void PushText(const std::string &text, float y, SDL_Color color);
+
+  std::vector<SDL_Vertex> m_vertices;
+  std::vector<int> m_indices;
+  bool m_quadsDirty = true;
+
 public: // screen debug
   static void UpdateScreenField(std::string key, std::string value);
   static void UpdateKeySettings(std::string key, KeySettings settings);
@@ -44,7 +72,6 @@ public: // screen debug
 private:
   std::unordered_map<std::string, std::string> debugValuesMap;
   std::unordered_map<std::string, KeySettings> keySettingsMap;
-  std::unordered_map<std::string, DebugTextInfoItem> textDebugInfoMap;
   std::vector<std::string> keysOrder;
 
 public: // console logging functions
@@ -1,6 +1,9 @@
 #include "DotRenderer.h"
+#include "CircleStamp.h"
 #include "Dots.h"
+#include "ScopeProfiler.h"
 #include "Settings.h"
+#include "Simd.h"
 #include "SimpleProfiler.h"
 #include "ThreadPool.h"
 
@@ -9,17 +12,23 @@
 #include <SDL3/SDL_render.h>
 
 // std
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <immintrin.h>
 #include <iostream>
 #include <thread>
+#include <utility>
+
+static_assert(DotRenderer::RADIUS_BUCKETS ==
+                  Dots::DEATH_RADIUS - Dots::RADIUS + 1,
+              "one radius bucket per radius a dot can have");
 
 DotRenderer::DotRenderer(SDL_Window *window, ThreadPool *threadPool,
                          Timer &timer)
-    : m_sdlRenderer(nullptr), m_threadPool(threadPool), timer(timer),
-      bufferSize(Settings::SCREEN_WIDTH * Settings::SCREEN_HEIGHT) {
+    : bufferSize(Settings::SCREEN_WIDTH * Settings::SCREEN_HEIGHT),
+      m_threadPool(threadPool), timer(timer), m_sdlRenderer(nullptr) {
   m_sdlRenderer = SDL_CreateRenderer(window, nullptr);
   if (!m_sdlRenderer)
     return;
@@ -33,27 +42,15 @@ DotRenderer::DotRenderer(SDL_Window *window, ThreadPool *threadPool,
       m_sdlRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
       Settings::SCREEN_WIDTH, Settings::SCREEN_HEIGHT);
 
-  // initialize circle cache
-  for (int r = Dots::RADIUS; r <= Dots::RADIUS + 3; ++r) {
-    CreateCircle(r);
-  }
+  m_tileStart.resize(BIN_COUNT + 1, 0);
 }
 
-// may be naive, but its precomputed anyways
-void DotRenderer::CreateCircle(int radius) {
-  CirclePixels newCircle;
-  for (int y = -radius; y <= radius; y++) {
-    for (int x = -radius; x <= radius; x++) {
-      if ((x * x + y * y) <= radius * radius) { // inside the circle
-        int startX = x;
-        while ((x * x) + (y * y) <= radius * radius) {
-          x++;
-        }
-        newCircle.spans.push_back({y, startX, x - startX});
-      }
-    }
-  }
-  circleCache[radius] = newCircle;
+DotRenderer::DotRenderer(ThreadPool *threadPool, Timer &timer)
+    : bufferSize(Settings::SCREEN_WIDTH * Settings::SCREEN_HEIGHT),
+      m_threadPool(threadPool), timer(timer), m_sdlRenderer(nullptr) {
+  m_combinedPixelBuffer = new (std::nothrow) uint32_t[bufferSize];
+
+  m_tileStart.resize(BIN_COUNT + 1, 0);
 }
 
 DotRenderer::~DotRenderer() {
@@ -92,99 +89,315 @@ void DotRenderer::DrawPoint(int x, int y) {
 }
 
 // =========================================================================================
-// SINGLE-PASS IMPLEMENTATION
+// TILE-BINNED IMPLEMENTATION
 // =========================================================================================
 void DotRenderer::BatchDrawCirclesCPUThreaded(
     float pos_x[], float pos_y[], uint8_t radii[],
-    std::vector<size_t> aliveIndices, Timer& timer) {
-  Timer& t_total = timer.startChild("batch_rendering");
+    const std::vector<size_t> &aliveIndices, Timer& timer) {
   size_t size = aliveIndices.size();
 
-  if (!m_sdlRenderer || size == 0)
+  // headless renderers still rasterize, they just skip the SDL calls
+  if (!m_combinedPixelBuffer || size == 0)
     return;
 
+  PROFILE_SCOPE("batch_rendering");
+  Timer& t_total = timer.startChild("batch_rendering");
 
-  // Clear the buffer for the new frame.
-  memset(m_combinedPixelBuffer, 0, bufferSize * sizeof(uint32_t));
-
-  const int nThreads = m_threadPool->num_threads;
-  const int rowsPerThread = Settings::SCREEN_HEIGHT / nThreads;
+  // bin once, so every tile job only touches its own dots
+  auto &t_binning = t_total.startChild("binning");
+  BinDots(pos_x, pos_y, radii, aliveIndices);
+  t_binning.stopClock();
+
+  // pick the target, the locked texture if we can get it
+  uint32_t *target = m_combinedPixelBuffer;
+  int pitch = Settings::SCREEN_WIDTH;
+  bool locked = false;
+  if (m_sdlRenderer && m_renderToTexture) {
+    void *pixels = nullptr;
+    int pitchBytes = 0;
+    if (SDL_LockTexture(frameTexture, nullptr, &pixels, &pitchBytes)) {
+      target = static_cast<uint32_t *>(pixels);
+      pitch = pitchBytes / static_cast<int>(sizeof(uint32_t));
+      locked = true;
+    }
+  }
 
-  // RENDER THREADING: One job per screen-space region
+  // RENDER THREADING: one job per tile, busy tiles get stolen by idle workers.
+  // Tiles write every pixel, so there is no clear of the full frame anymore.
   auto &t_drawing = t_total.startChild("drawing_and_blending");
-  auto &t_queueing = t_drawing.startChild("queuing_jobs");
-  for (int t = 0; t < nThreads; ++t) {
-    // 1. Divide the screen into horizontal regions (rows) for each thread
-    const int startY = t * rowsPerThread;
-    const int endY =
-        (t == nThreads - 1) ? Settings::SCREEN_HEIGHT : startY + rowsPerThread;
-
-    m_threadPool->queueJob(
-      [this, &aliveIndices, pos_x, pos_y, radii, size, startY, endY]() {
-        for (size_t di = 0; di < size; ++di) {
-          size_t index = aliveIndices[di];
-
-          const int cX = static_cast<int>(pos_x[index]);
-          const int cY = static_cast<int>(pos_y[index]);
-          const int radius = radii[index];
-
-          // quick bound check if to skip dots not in this region
-          if(cY + radius < startY || cY - radius >= endY)
-            continue;
-
-          // find the cached dot
-          auto it = circleCache.find(radius);
-          if(it == circleCache.end())
-            continue;
-
-          // calculate color of this dot
-          constexpr float foo = 0.5f * 255.f * 4.f;
-          uint8_t red = (radii[index] - Dots::RADIUS) * foo;
-          // ARGB
-          uint32_t color = (255 << 24) | (red << 16) | (125 << 8) | 125; 
-
-          for(const auto &span : it->second.spans){
-            int pixelY = cY + span.y_offset;
-
-            // draw pixel span ONLY if it falls within this threads region
-            if(pixelY >= startY && pixelY < endY){
-              int startX = cX + span.x_start_offset;
-              int endX = startX + span.length;
-
-              int clampedStartX = std::max(0, startX);
-              int clampedEndX = std::min(Settings::SCREEN_WIDTH, endX);
-              int clampedLength = clampedEndX - clampedStartX;
-
-              if(clampedLength > 0){
-                size_t pixelIndex = clampedStartX + pixelY * Settings::SCREEN_WIDTH;
-
-                // blend the entire contiguos scanline using the SIMD function
-                BlendSolidColorSIMD(color, m_combinedPixelBuffer + pixelIndex, clampedLength);
-              }
-            }
-          }
+  m_threadPool->parallel_for(
+      0, TILE_COUNT, 1,
+      [this, pos_x, pos_y, target, pitch](size_t first, size_t last) {
+        for (size_t tile = first; tile < last; ++tile) {
+          DrawTile(static_cast<int>(tile), pos_x, pos_y, target, pitch);
         }
       });
-  }
-  t_queueing.stopClock();
-
-  // wait only ONCE for all rendering jobs to complete.
-  auto &t_wait = t_drawing.startChild("wait_for_threads");
-  m_threadPool->wait();
-  t_wait.stopClock();
   t_drawing.stopClock();
 
+  if (!m_sdlRenderer) {
+    t_total.stopClock();
+    return;
+  }
+
   // update and render texture
   auto &t_sdlCalls = t_total.startChild("sdl_calls");
-  SDL_UpdateTexture(frameTexture, nullptr, m_combinedPixelBuffer,
-                    Settings::SCREEN_WIDTH * sizeof(uint32_t));
+  if (locked) {
+    SDL_UnlockTexture(frameTexture);
+  } else {
+    SDL_UpdateTexture(frameTexture, nullptr, m_combinedPixelBuffer,
+                      Settings::SCREEN_WIDTH * sizeof(uint32_t));
+  }
   SDL_RenderTexture(m_sdlRenderer, frameTexture, nullptr, nullptr);
   t_sdlCalls.stopClock();
   t_total.stopClock();
 }
 
+// tile range touched by a dot, clamped to the screen
+static void tileRange(float x, float y, int radius, int &minTX, int &maxTX,
+                      int &minTY, int &maxTY) {
+  const int cX = static_cast<int>(x);
+  const int cY = static_cast<int>(y);
+  minTX = std::clamp((cX - radius) / DotRenderer::TILE_SIZE, 0,
+                     DotRenderer::TILES_X - 1);
+  maxTX = std::clamp((cX + radius) / DotRenderer::TILE_SIZE, 0,
+                     DotRenderer::TILES_X - 1);
+  minTY = std::clamp((cY - radius) / DotRenderer::TILE_SIZE, 0,
+                     DotRenderer::TILES_Y - 1);
+  maxTY = std::clamp((cY + radius) / DotRenderer::TILE_SIZE, 0,
+                     DotRenderer::TILES_Y - 1);
+}
+
+void DotRenderer::BinDots(const float pos_x[], const float pos_y[],
+                          const uint8_t radii[],
+                          const std::vector<size_t> &aliveIndices) {
+  const size_t size = aliveIndices.size();
+  const size_t maxChunks = size_t(m_threadPool->num_threads) * 2;
+  const size_t numChunks =
+      std::clamp(size / MIN_DOTS_PER_CHUNK, size_t(1), maxChunks);
+  const size_t chunkSize = (size + numChunks - 1) / numChunks;
+  m_chunkTileCounts.resize(numChunks * BIN_COUNT);
+
+  // pass 1: every chunk counts how many dots touch each tile
+  m_threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+    PROFILE_SCOPE("bin_count");
+    for (size_t chunk = first; chunk < last; ++chunk) {
+      uint32_t *counts = m_chunkTileCounts.data() + chunk * BIN_COUNT;
+      std::fill(counts, counts + BIN_COUNT, 0);
+
+      const size_t end = std::min(size, (chunk + 1) * chunkSize);
+      for (size_t di = chunk * chunkSize; di < end; ++di) {
+        size_t index = aliveIndices[di];
+        const unsigned bucket = radii[index] - Dots::RADIUS;
+        if (bucket >= RADIUS_BUCKETS)
+          continue;
+        int minTX, maxTX, minTY, maxTY;
+        tileRange(pos_x[index], pos_y[index], radii[index], minTX, maxTX,
+                  minTY, maxTY);
+        for (int ty = minTY; ty <= maxTY; ++ty)
+          for (int tx = minTX; tx <= maxTX; ++tx)
+            counts[(ty * TILES_X + tx) * RADIUS_BUCKETS + bucket]++;
+      }
+    }
+  });
+
+  // exclusive prefix sum, bin major
+  uint32_t offset = 0;
+  for (int bin = 0; bin < BIN_COUNT; ++bin) {
+    m_tileStart[bin] = offset;
+    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+      uint32_t &count = m_chunkTileCounts[chunk * BIN_COUNT + bin];
+      uint32_t chunkOffset = offset;
+      offset += count;
+      count = chunkOffset;
+    }
+  }
+  m_tileStart[BIN_COUNT] = offset;
+
+  // pass 2: scatter the dot indices into the tiles
+  m_tileDots.resize(offset);
+  m_threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+    PROFILE_SCOPE("bin_scatter");
+    for (size_t chunk = first; chunk < last; ++chunk) {
+      uint32_t *cursor = m_chunkTileCounts.data() + chunk * BIN_COUNT;
+      const size_t end = std::min(size, (chunk + 1) * chunkSize);
+      for (size_t di = chunk * chunkSize; di < end; ++di) {
+        size_t index = aliveIndices[di];
+        const unsigned bucket = radii[index] - Dots::RADIUS;
+        if (bucket >= RADIUS_BUCKETS)
+          continue;
+        int minTX, maxTX, minTY, maxTY;
+        tileRange(pos_x[index], pos_y[index], radii[index], minTX, maxTX,
+                  minTY, maxTY);
+        for (int ty = minTY; ty <= maxTY; ++ty)
+          for (int tx = minTX; tx <= maxTX; ++tx)
+            m_tileDots[cursor[(ty * TILES_X + tx) * RADIUS_BUCKETS +
+                              bucket]++] = static_cast<uint32_t>(index);
+      }
+    }
+  });
+}
+
+void DotRenderer::DrawTile(int tile, const float pos_x[], const float pos_y[],
+                           uint32_t *target, int pitch) {
+  PROFILE_SCOPE("draw_tile");
+  const int startX = (tile % TILES_X) * TILE_SIZE;
+  const int startY = (tile / TILES_X) * TILE_SIZE;
+  const int width = std::min(Settings::SCREEN_WIDTH - startX, TILE_SIZE);
+  const int height = std::min(Settings::SCREEN_HEIGHT - startY, TILE_SIZE);
+
+  // 16 KB, stays in L1 while the tile is drawn. The stamps may read a few
+  // pixels past the last row, see CircleStamp::OVERHANG
+  alignas(64) thread_local uint32_t tileBuffer[TILE_SIZE * TILE_SIZE + 4];
+  memset(tileBuffer, 0, sizeof(tileBuffer));
+
+  // one bin per radius, so every dot of a bin goes through the same stamp
+  [&]<int... Bucket>(std::integer_sequence<int, Bucket...>) {
+    (DrawStamps<Dots::RADIUS + Bucket>(tile * RADIUS_BUCKETS + Bucket, startX,
+                                       startY, width, height, pos_x, pos_y,
+                                       tileBuffer),
+     ...);
+  }(std::make_integer_sequence<int, RADIUS_BUCKETS>{});
+
+  // stream the finished tile out, it won't be read again by the cpu so
+  // there is no point in pulling the target lines into the cache
+  for (int y = 0; y < height; ++y) {
+    const uint32_t *src = tileBuffer + y * TILE_SIZE;
+    uint32_t *dst = target + size_t(startY + y) * pitch + startX;
+
+    // tile widths are multiples of 4 pixels, only the row start can be off
+    if (reinterpret_cast<uintptr_t>(dst) % 16 != 0) {
+      memcpy(dst, src, width * sizeof(uint32_t));
+      continue;
+    }
+    for (int x = 0; x < width; x += 4) {
+      _mm_stream_si128(reinterpret_cast<__m128i *>(dst + x),
+                       _mm_load_si128(reinterpret_cast<const __m128i *>(src + x)));
+    }
+  }
+  // streaming stores are weakly ordered, make them visible before the job ends
+  _mm_sfence();
+}
+
+template <int R>
+void DotRenderer::DrawStamps(int bin, int startX, int startY, int width,
+                             int height, const float pos_x[],
+                             const float pos_y[], uint32_t *tileBuffer) {
+  using Stamp = CircleStamp<R>;
+  static_assert(Stamp::OVERHANG <= 4, "tileBuffer pads 4 pixels");
+
+  for (uint32_t k = m_tileStart[bin]; k < m_tileStart[bin + 1]; ++k) {
+    const uint32_t index = m_tileDots[k];
+
+    // tile local center
+    const int cX = static_cast<int>(pos_x[index]) - startX;
+    const int cY = static_cast<int>(pos_y[index]) - startY;
+
+    // most dots are inside the tile, those are stamped whole
+    if (cX >= R && cY >= R && cX + R < width && cY + R < height) {
+      Stamp::blend(tileBuffer + (cY - R) * TILE_SIZE + (cX - R), TILE_SIZE);
+      continue;
+    }
+
+    for (int row = 0; row < Stamp::ROWS; row++) {
+      int pixelY = cY + row - R;
+      if (pixelY < 0 || pixelY >= height)
+        continue;
+
+      // clip the span to this tile
+      const int half = Stamp::halfWidths[row];
+      int clampedStartX = std::max(0, cX - half);
+      int clampedEndX = std::min(width, cX + half + 1);
+      int clampedLength = clampedEndX - clampedStartX;
+
+      if (clampedLength > 0) {
+        BlendSolidColorSIMD(Stamp::COLOR,
+                            tileBuffer + pixelY * TILE_SIZE + clampedStartX,
+                            clampedLength);
+      }
+    }
+  }
+}
+
+// The wide blends add bytes with saturation, the same as the 16 bit unpack
+// and pack of the SSE loops. They stop at the last full 4 pixels, so every
+// level leaves the same scalar tail and writes the exact same pixels.
+
+SIMD_TARGET("avx2")
+static size_t blendSolidColorAVX2(uint32_t color, uint32_t *dst, size_t size) {
+  const __m256i src = _mm256_set1_epi32(color);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256i *pixels = reinterpret_cast<__m256i *>(dst + i);
+    _mm256_storeu_si256(pixels,
+                        _mm256_adds_epu8(_mm256_loadu_si256(pixels), src));
+  }
+  return i; // the SSE loop picks up the last 4 pixels
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+static size_t blendSolidColorAVX512(uint32_t color, uint32_t *dst,
+                                    size_t size) {
+  const __m512i src = _mm512_set1_epi32(color);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    _mm512_storeu_si512(dst + i,
+                        _mm512_adds_epu8(_mm512_loadu_si512(dst + i), src));
+  }
+  // one masked block for the rest, masked lanes are neither read nor written
+  const size_t rest = (size - i) & ~size_t(3);
+  const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+  _mm512_mask_storeu_epi32(
+      dst + i, mask,
+      _mm512_adds_epu8(_mm512_maskz_loadu_epi32(mask, dst + i), src));
+  return i + rest;
+}
+
+SIMD_TARGET("avx2")
+static size_t blendAdditiveAVX2(const uint32_t *src, uint32_t *dst,
+                                size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256i *pixels = reinterpret_cast<__m256i *>(dst + i);
+    _mm256_storeu_si256(
+        pixels,
+        _mm256_adds_epu8(_mm256_loadu_si256(pixels),
+                         _mm256_loadu_si256(
+                             reinterpret_cast<const __m256i *>(src + i))));
+  }
+  return i;
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+static size_t blendAdditiveAVX512(const uint32_t *src, uint32_t *dst,
+                                  size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    _mm512_storeu_si512(dst + i, _mm512_adds_epu8(_mm512_loadu_si512(dst + i),
+                                                  _mm512_loadu_si512(src + i)));
+  }
+  const size_t rest = (size - i) & ~size_t(3);
+  const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+  _mm512_mask_storeu_epi32(
+      dst + i, mask,
+      _mm512_adds_epu8(_mm512_maskz_loadu_epi32(mask, dst + i),
+                       _mm512_maskz_loadu_epi32(mask, src + i)));
+  return i + rest;
+}
+
 void DotRenderer::BlendSolidColorSIMD(uint32_t color, uint32_t *dst_buffer,
                                       size_t size) {
+  size_t i = 0;
+  switch (Simd::active()) {
+  case Simd::Level::AVX512:
+    i = blendSolidColorAVX512(color, dst_buffer, size);
+    break;
+  case Simd::Level::AVX2:
+    i = blendSolidColorAVX2(color, dst_buffer, size);
+    break;
+  default:
+    break;
+  }
+
   // Create a 128-bit register with the solid color broadcast to all 4 lanes
   __m128i src_pixels = _mm_set1_epi32(color);
 
@@ -194,7 +407,6 @@ void DotRenderer::BlendSolidColorSIMD(uint32_t color, uint32_t *dst_buffer,
   __m128i src_lo = _mm_unpacklo_epi8(src_pixels, zero);
   __m128i src_hi = _mm_unpackhi_epi8(src_pixels, zero);
 
-  size_t i = 0;
   for (; i + 3 < size; i += 4) {
     // load the dst pixels into a 128-bit (4x4 byte integers)
     __m128i dst_pixels = _mm_loadu_si128((__m128i *)(dst_buffer + i));
@@ -226,8 +438,19 @@ void DotRenderer::BlendSolidColorSIMD(uint32_t color, uint32_t *dst_buffer,
 
 void DotRenderer::BlendAdditiveSIMD(uint32_t *src_buffer, uint32_t *dst_buffer,
                                     size_t size) {
-  // Process 4 pixels at a time
   size_t i = 0;
+  switch (Simd::active()) {
+  case Simd::Level::AVX512:
+    i = blendAdditiveAVX512(src_buffer, dst_buffer, size);
+    break;
+  case Simd::Level::AVX2:
+    i = blendAdditiveAVX2(src_buffer, dst_buffer, size);
+    break;
+  default:
+    break;
+  }
+
+  // Process 4 pixels at a time
   for (; i + 3 < size; i += 4) {
     // Load 4 pixels from each buffer into 128-bit registers
     __m128i src_pixels = _mm_loadu_si128((__m128i *)(src_buffer + i));
@@ -1,50 +1,108 @@
 #pragma once
+#include "Settings.h"
 #include "SimpleProfiler.h"
 #include <SDL3/SDL.h>
 #include <atomic>
 #include <cstdint>
-#include <unordered_map>
 #include <vector>
 
 class ThreadPool;
 struct Timer;
 
 class DotRenderer {
+public:
+  // the screen is rasterized in square tiles, one job per tile
+  static constexpr int TILE_SIZE = 64;
+  static constexpr int TILES_X = (Settings::SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+  static constexpr int TILES_Y = (Settings::SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+  static constexpr int TILE_COUNT = TILES_X * TILES_Y;
+  static constexpr size_t MIN_DOTS_PER_CHUNK = 4096; // binning
+  // one bin per radius a dot can be drawn with, Dots::RADIUS and up
+  static constexpr int RADIUS_BUCKETS = 4;
+  static constexpr int BIN_COUNT = TILE_COUNT * RADIUS_BUCKETS;
+  static_assert(Settings::SCREEN_WIDTH % 4 == 0,
+                "tiles are streamed out 4 pixels at a time");
+
 private:
   bool isOutOfBounds(int x, int y) const;
 
 private:
-  // struct CirclePixels {
-  //   std::vector<std::pair<int, int>> offsets;
-  // };
-
-  struct CircleSpan {
-    int y_offset;
-    int x_start_offset;
-    int length;
-  };
+  // dots binned per screen tile and radius (CSR, like the SpatialGrid): the
+  // dots of radius Dots::RADIUS + r touching tile t are
+  // m_tileDots[m_tileStart[b] .. m_tileStart[b + 1]) with
+  // b = t * RADIUS_BUCKETS + r
+  std::vector<uint32_t> m_tileStart;
+  std::vector<uint32_t> m_tileDots;
+  std::vector<uint32_t> m_chunkTileCounts; // [chunk][bin], scratch
 
-  struct CirclePixels{
-    std::vector<CircleSpan> spans;
-  };
+  /*
+  * Sorts the dots into the tiles their bounding box touches, and by radius
+  * inside a tile. Counting sort with one histogram per chunk of dots, so it
+  * runs in parallel. Radii that can't be drawn are left out.
+  */
+  void BinDots(const float pos_x[], const float pos_y[], const uint8_t radii[],
+               const std::vector<size_t> &aliveIndices);
+  /*
+  * Draws every dot binned into a tile into a small thread local buffer, then
+  * streams the finished tile to the target with non-temporal stores. Every
+  * tile writes all of its pixels, so the target never has to be cleared, and
+  * no other tile writes them, so tiles can be drawn in parallel.
+  *
+  * @param target First pixel of the frame (buffer or locked texture)
+  * @param pitch Pixels per row of the target
+  */
+  void DrawTile(int tile, const float pos_x[], const float pos_y[],
+                uint32_t *target, int pitch);
+  /*
+  * Draws the dots of one bin, they all have radius R. Dots inside the tile
+  * go through CircleStamp<R>, the ones on the tile edges are clipped row by
+  * row.
+  *
+  * @param bin The bin in m_tileStart
+  * @param tileBuffer The tile, TILE_SIZE pixels per row
+  */
+  template <int R>
+  void DrawStamps(int bin, int startX, int startY, int width, int height,
+                  const float pos_x[], const float pos_y[],
+                  uint32_t *tileBuffer);
 
-  std::unordered_map<int, CirclePixels> circleCache;
-  void CreateCircle(int radius);
+  // rasterize straight into the locked streaming texture instead of the
+  // CPU buffer, saves the SDL_UpdateTexture copy
+  bool m_renderToTexture = true;
 
-  uint32_t *m_combinedPixelBuffer;
+  uint32_t *m_combinedPixelBuffer = nullptr;
   const size_t bufferSize;
 
-  SDL_Texture *frameTexture;
+  SDL_Texture *frameTexture = nullptr;
 
   ThreadPool *m_threadPool;
   Timer &timer;
 
 public:
   DotRenderer(SDL_Window *window, ThreadPool *threadPool, Timer &timer);
+  /*
+  * Creates a headless renderer. There is no SDL renderer, dots are only
+  * rasterized into the CPU pixel buffer.
+  *
+  * @param threadPool The thread pool used for rasterizing
+  * @param timer Reference to a benchmark timer
+  */
+  DotRenderer(ThreadPool *threadPool, Timer &timer);
 
   ~DotRenderer();
 
   SDL_Renderer *GetSDLRenderer() const { return m_sdlRenderer; }
+  const uint32_t *GetPixelBuffer() const { return m_combinedPixelBuffer; }
+
+  /*
+  * Picks where the dots are rasterized. With an SDL renderer the default is
+  * the locked frame texture, the CPU pixel buffer is then left untouched.
+  * Headless renderers always use the CPU pixel buffer.
+  */
+  void SetRenderToTexture(bool renderToTexture) {
+    m_renderToTexture = renderToTexture;
+  }
+  bool GetRenderToTexture() const { return m_renderToTexture; }
 
   void SetDrawColor(Uint8 r, Uint8 g, Uint8 b, Uint8 a);
   void Clear();
@@ -55,10 +113,10 @@ public:
                      const SDL_FRect *dstRect);
   void BatchDrawCirclesCPUThreaded(float pos_x[], float pos_y[],
                                    uint8_t radii[],
-                                   std::vector<size_t> aliveIndices,
+                                   const std::vector<size_t> &aliveIndices,
                                    Timer& timer);
   /*
-  * Blends the pixels of the src and dst register, and outputs the result to the dst buffer. Uses SIMD to process 4 pixels at a time.
+  * Blends the pixels of the src and dst register, and outputs the result to the dst buffer. Uses SIMD to process 16, 8 or 4 pixels at a time, depending on Simd::active().
   *
   * @param src The src pixel color buffer
   * @param dst The dst pixel color buffer
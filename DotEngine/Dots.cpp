@@ -1,35 +1,90 @@
 #include "Dots.h"
 #include "Debug.h"
 #include "DotRenderer.h"
+#include "MortonOrder.h"
+#include "ScopeProfiler.h"
 #include "Settings.h"
+#include "Simd.h"
+#include "ThreadPool.h"
 #include "glm/gtc/constants.hpp"
+#include <algorithm>
 #include <cstring>
 #include <ctime>
+#include <fstream>
+#include <immintrin.h>
 #include <random>
+#include <sstream>
 
-thread_local std::mt19937 Dots::rng;
-thread_local std::uniform_real_distribution<float> Dots::angleDist;
-thread_local std::uniform_int_distribution<int> Dots::xDist;
-thread_local std::uniform_int_distribution<int> Dots::yDist;
-thread_local bool Dots::initialized = false;
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool Dots::useFixedSeed = false;
+uint32_t Dots::fixedSeed = 0;
+Dots::Scene Dots::scene = Dots::Scene::Uniform;
+float Dots::clusterX[CLUSTER_COUNT];
+float Dots::clusterY[CLUSTER_COUNT];
 
 // Constructor
-Dots::Dots() {
-  std::string dotsCountText = "DOTS_AMOUNT: " + std::to_string(MAX_DOTS);
+Dots::Dots(size_t count)
+    : count(count), positions_x(count), positions_y(count),
+      velocities_x(count), velocities_y(count), radii(count), alive(count) {
+  std::string dotsCountText = "DOTS_AMOUNT: " + std::to_string(count);
   Debug::UpdateScreenField("DOTS", dotsCountText);
 }
 
 // Deconstructor
 Dots::~Dots() {}
 
+void Dots::setSeed(uint32_t seed) {
+  fixedSeed = seed;
+  useFixedSeed = true;
+}
+
+void Dots::setScene(Scene newScene) {
+  scene = newScene;
+  // the centers stay away from the edges, so the clusters are round
+  std::mt19937 centerRng(useFixedSeed ? fixedSeed
+                                      : static_cast<unsigned int>(time(nullptr)));
+  std::uniform_real_distribution<float> xCenter(
+      CLUSTER_SPREAD * 2.f, Settings::SCREEN_WIDTH - CLUSTER_SPREAD * 2.f);
+  std::uniform_real_distribution<float> yCenter(
+      CLUSTER_SPREAD * 2.f, Settings::SCREEN_HEIGHT - CLUSTER_SPREAD * 2.f);
+  for (int c = 0; c < CLUSTER_COUNT; c++) {
+    clusterX[c] = xCenter(centerRng);
+    clusterY[c] = yCenter(centerRng);
+  }
+}
+
+void Dots::placeDot(size_t index) {
+  if (scene == Scene::Uniform) {
+    positions_x[index] = xDist(rng);
+    positions_y[index] = yDist(rng);
+    return;
+  }
+
+  const int c = std::uniform_int_distribution<int>(0, CLUSTER_COUNT - 1)(rng);
+  std::normal_distribution<float> spread(0.f, CLUSTER_SPREAD);
+  positions_x[index] =
+      std::clamp(clusterX[c] + spread(rng), 0.f, float(Settings::SCREEN_WIDTH));
+  positions_y[index] = std::clamp(clusterY[c] + spread(rng), 0.f,
+                                  float(Settings::SCREEN_HEIGHT));
+}
+
 void Dots::ensureRngInit() {
-  if (!initialized) {
-    rng.seed(static_cast<unsigned int>(time(nullptr)));
+  if (!rngInitialized) {
+    rng.seed(useFixedSeed ? fixedSeed
+                          : static_cast<unsigned int>(time(nullptr)));
     angleDist =
         std::uniform_real_distribution<float>(0.0f, 2.0f * glm::pi<float>());
     xDist = std::uniform_int_distribution<int>(0, Settings::SCREEN_WIDTH - 1);
     yDist = std::uniform_int_distribution<int>(0, Settings::SCREEN_HEIGHT - 1);
-    initialized = true;
+    rngInitialized = true;
   }
 }
 
@@ -37,13 +92,14 @@ void Dots::ensureRngInit() {
 void Dots::init() {
   ensureRngInit();
 
-  alive_indices.reserve(MAX_DOTS); // avoid capacity thrashing
-  for (int i = 0; i < MAX_DOTS; i++) {
+  alive_indices.clear();
+  alive_indices.reserve(count); // avoid capacity thrashing
+  dead_indices.clear();
+  for (size_t i = 0; i < count; i++) {
     alive_indices.push_back(i);
 
     // get random x and y positions
-    positions_x[i] = xDist(rng);
-    positions_y[i] = yDist(rng);
+    placeDot(i);
 
     // get random angle
     float angle = angleDist(rng);
@@ -54,28 +110,169 @@ void Dots::init() {
 
     // give starting radius
     radii[i] = RADIUS;
+    alive[i] = 1;
   }
 }
 
+void Dots::resize(size_t newCount) {
+  size_t oldCount = count;
+  positions_x.resize(newCount);
+  positions_y.resize(newCount);
+  velocities_x.resize(newCount);
+  velocities_y.resize(newCount);
+  radii.resize(newCount);
+  alive.resize(newCount);
+  count = newCount;
+
+  if (newCount < oldCount) {
+    // forget the dots that no longer exist
+    std::erase_if(alive_indices,
+                  [newCount](size_t index) { return index >= newCount; });
+    std::erase_if(dead_indices,
+                  [newCount](size_t index) { return index >= newCount; });
+  } else {
+    alive_indices.reserve(newCount);
+    for (size_t i = oldCount; i < newCount; i++) {
+      initDot(i);
+      alive_indices.push_back(i);
+    }
+  }
+
+  std::string dotsCountText = "DOTS_AMOUNT: " + std::to_string(count);
+  Debug::UpdateScreenField("DOTS", dotsCountText);
+}
+
 // Reinitializes a single dot
 void Dots::initDot(size_t index) {
   ensureRngInit();
 
   // same randomness
-  positions_x[index] = xDist(rng);
-  positions_y[index] = yDist(rng);
+  placeDot(index);
 
   float angle = angleDist(rng);
   velocities_x[index] = std::cos(angle);
   velocities_y[index] = std::sin(angle);
 
   radii[index] = RADIUS;
+  alive[index] = 1;
+}
+
+void Dots::compact(ThreadPool *threadPool, const uint8_t *flags,
+                   uint8_t aliveBit) {
+  const size_t numChunks =
+      std::max<size_t>(1, (count + COMPACT_GRAIN - 1) / COMPACT_GRAIN);
+  chunkAlive.resize(numChunks);
+  chunkDead.resize(numChunks);
+
+  auto countChunk = [this, flags, aliveBit](size_t chunk) {
+    PROFILE_SCOPE("compact_count");
+    const size_t end = std::min(count, (chunk + 1) * COMPACT_GRAIN);
+    uint32_t aliveCount = 0;
+    for (size_t i = chunk * COMPACT_GRAIN; i < end; i++)
+      aliveCount += (flags[i] & aliveBit) != 0;
+    chunkAlive[chunk] = aliveCount;
+    chunkDead[chunk] =
+        static_cast<uint32_t>(end - chunk * COMPACT_GRAIN - aliveCount);
+  };
+  auto scatterChunk = [this, flags, aliveBit](size_t chunk) {
+    PROFILE_SCOPE("compact_scatter");
+    size_t *aliveOut = alive_indices.data() + chunkAlive[chunk];
+    size_t *deadOut = dead_indices.data() + chunkDead[chunk];
+    const size_t end = std::min(count, (chunk + 1) * COMPACT_GRAIN);
+    for (size_t i = chunk * COMPACT_GRAIN; i < end; i++) {
+      if (flags[i] & aliveBit)
+        *aliveOut++ = i;
+      else
+        *deadOut++ = i;
+    }
+  };
+
+  // pass 1: alive and dead dots per chunk
+  if (threadPool && numChunks > 1) {
+    threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; chunk++)
+        countChunk(chunk);
+    });
+  } else {
+    for (size_t chunk = 0; chunk < numChunks; chunk++)
+      countChunk(chunk);
+  }
+
+  // exclusive prefix sums, the counts turn into write positions
+  uint32_t aliveOffset = 0;
+  uint32_t deadOffset = 0;
+  for (size_t chunk = 0; chunk < numChunks; chunk++) {
+    const uint32_t aliveCount = chunkAlive[chunk];
+    const uint32_t deadCount = chunkDead[chunk];
+    chunkAlive[chunk] = aliveOffset;
+    chunkDead[chunk] = deadOffset;
+    aliveOffset += aliveCount;
+    deadOffset += deadCount;
+  }
+  alive_indices.resize(aliveOffset);
+  dead_indices.resize(deadOffset);
+
+  // pass 2: every chunk writes its own slots
+  if (threadPool && numChunks > 1) {
+    threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; chunk++)
+        scatterChunk(chunk);
+    });
+  } else {
+    for (size_t chunk = 0; chunk < numChunks; chunk++)
+      scatterChunk(chunk);
+  }
 }
 
-void Dots::updateAll(float deltaTime) {
-  for (size_t i : alive_indices) {
-    positions_x[i] += velocities_x[i] * VELOCITY * deltaTime;
-    positions_y[i] += velocities_y[i] * VELOCITY * deltaTime;
+size_t Dots::respawnDead() {
+  const size_t respawned = dead_indices.size();
+  for (size_t index : dead_indices) {
+    initDot(index);
+    alive_indices.push_back(index);
+  }
+  dead_indices.clear();
+  return respawned;
+}
+
+void Dots::sortByMorton(MortonOrder &mortonOrder, ThreadPool *threadPool) {
+  PROFILE_SCOPE("dots_reorder");
+  mortonOrder.sort(
+      count,
+      [this](size_t i) {
+        return isAlive(i) ? MortonOrder::key(positions_x[i], positions_y[i])
+                          : MortonOrder::DEAD_KEY;
+      },
+      threadPool);
+  mortonOrder.apply(positions_x, threadPool);
+  mortonOrder.apply(positions_y, threadPool);
+  mortonOrder.apply(velocities_x, threadPool);
+  mortonOrder.apply(velocities_y, threadPool);
+  mortonOrder.apply(radii, threadPool);
+  mortonOrder.apply(alive, threadPool);
+
+  // the flags moved with the dots, the lists are rebuilt from them
+  compact(threadPool);
+}
+
+void Dots::updateAll(float deltaTime, ThreadPool *threadPool) {
+  PROFILE_SCOPE("dots_update");
+  threadPool->parallel_for(0, count, UPDATE_GRAIN,
+                           [this, deltaTime](size_t begin, size_t end) {
+                             updateRange(begin, end, deltaTime);
+                           });
+}
+
+void Dots::updateRange(size_t begin, size_t end, float deltaTime) {
+  PROFILE_SCOPE("update_range");
+  const float step = VELOCITY * deltaTime;
+  size_t i = Simd::active() >= Simd::Level::AVX2
+                 ? updateRangeAVX2(begin, end, step)
+                 : updateRangeSSE4(begin, end, step);
+
+  // leftovers
+  for (; i < end; i++) {
+    positions_x[i] += velocities_x[i] * step;
+    positions_y[i] += velocities_y[i] * step;
 
     // X-Axis bounds check
     if (positions_x[i] - radii[i] < 0.0f) {
@@ -97,12 +294,346 @@ void Dots::updateAll(float deltaTime) {
   }
 }
 
+SIMD_TARGET("avx2")
+size_t Dots::updateRangeAVX2(size_t begin, size_t end, float step) {
+  size_t i = begin;
+  const __m256 v_step = _mm256_set1_ps(step);
+  const __m256 v_zero = _mm256_setzero_ps();
+  const __m256 v_width = _mm256_set1_ps(float(Settings::SCREEN_WIDTH));
+  const __m256 v_height = _mm256_set1_ps(float(Settings::SCREEN_HEIGHT));
+  const __m256 v_sign = _mm256_set1_ps(-0.f);
+
+  for (; i + 8 <= end; i += 8) {
+    __m256 px = _mm256_loadu_ps(&positions_x[i]);
+    __m256 py = _mm256_loadu_ps(&positions_y[i]);
+    __m256 vx = _mm256_loadu_ps(&velocities_x[i]);
+    __m256 vy = _mm256_loadu_ps(&velocities_y[i]);
+    // 8 radii, uint8 -> int32 -> float
+    __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&radii[i]))));
+
+    px = _mm256_add_ps(px, _mm256_mul_ps(vx, v_step));
+    py = _mm256_add_ps(py, _mm256_mul_ps(vy, v_step));
+
+    // X-Axis bounds check, clamp into the screen and flip the velocity sign
+    __m256 lowX = _mm256_cmp_ps(_mm256_sub_ps(px, r), v_zero, _CMP_LT_OQ);
+    __m256 highX = _mm256_cmp_ps(_mm256_add_ps(px, r), v_width, _CMP_GT_OQ);
+    px = _mm256_blendv_ps(px, r, lowX);
+    px = _mm256_blendv_ps(px, _mm256_sub_ps(v_width, r), highX);
+    vx = _mm256_xor_ps(vx, _mm256_and_ps(_mm256_or_ps(lowX, highX), v_sign));
+
+    // Y-Axis bounds check
+    __m256 lowY = _mm256_cmp_ps(_mm256_sub_ps(py, r), v_zero, _CMP_LT_OQ);
+    __m256 highY = _mm256_cmp_ps(_mm256_add_ps(py, r), v_height, _CMP_GT_OQ);
+    py = _mm256_blendv_ps(py, r, lowY);
+    py = _mm256_blendv_ps(py, _mm256_sub_ps(v_height, r), highY);
+    vy = _mm256_xor_ps(vy, _mm256_and_ps(_mm256_or_ps(lowY, highY), v_sign));
+
+    _mm256_storeu_ps(&positions_x[i], px);
+    _mm256_storeu_ps(&positions_y[i], py);
+    _mm256_storeu_ps(&velocities_x[i], vx);
+    _mm256_storeu_ps(&velocities_y[i], vy);
+  }
+  return i;
+}
+
+size_t Dots::updateRangeSSE4(size_t begin, size_t end, float step) {
+  size_t i = begin;
+  const __m128 v_step = _mm_set1_ps(step);
+  const __m128 v_zero = _mm_setzero_ps();
+  const __m128 v_width = _mm_set1_ps(float(Settings::SCREEN_WIDTH));
+  const __m128 v_height = _mm_set1_ps(float(Settings::SCREEN_HEIGHT));
+  const __m128 v_sign = _mm_set1_ps(-0.f);
+
+  for (; i + 4 <= end; i += 4) {
+    __m128 px = _mm_loadu_ps(&positions_x[i]);
+    __m128 py = _mm_loadu_ps(&positions_y[i]);
+    __m128 vx = _mm_loadu_ps(&velocities_x[i]);
+    __m128 vy = _mm_loadu_ps(&velocities_y[i]);
+    // 4 radii, uint8 -> int32 -> float
+    int packedRadii;
+    memcpy(&packedRadii, &radii[i], sizeof(packedRadii));
+    __m128 r = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packedRadii)));
+
+    px = _mm_add_ps(px, _mm_mul_ps(vx, v_step));
+    py = _mm_add_ps(py, _mm_mul_ps(vy, v_step));
+
+    // X-Axis bounds check, clamp into the screen and flip the velocity sign
+    __m128 lowX = _mm_cmplt_ps(_mm_sub_ps(px, r), v_zero);
+    __m128 highX = _mm_cmpgt_ps(_mm_add_ps(px, r), v_width);
+    px = _mm_blendv_ps(px, r, lowX);
+    px = _mm_blendv_ps(px, _mm_sub_ps(v_width, r), highX);
+    vx = _mm_xor_ps(vx, _mm_and_ps(_mm_or_ps(lowX, highX), v_sign));
+
+    // Y-Axis bounds check
+    __m128 lowY = _mm_cmplt_ps(_mm_sub_ps(py, r), v_zero);
+    __m128 highY = _mm_cmpgt_ps(_mm_add_ps(py, r), v_height);
+    py = _mm_blendv_ps(py, r, lowY);
+    py = _mm_blendv_ps(py, _mm_sub_ps(v_height, r), highY);
+    vy = _mm_xor_ps(vy, _mm_and_ps(_mm_or_ps(lowY, highY), v_sign));
+
+    _mm_storeu_ps(&positions_x[i], px);
+    _mm_storeu_ps(&positions_y[i], py);
+    _mm_storeu_ps(&velocities_x[i], vx);
+    _mm_storeu_ps(&velocities_y[i], vy);
+  }
+  return i;
+}
+
+// ####################
+// ##   SNAPSHOTS:   ##
+// ####################
+namespace {
+enum SnapshotSection {
+  SECTION_POSITIONS_X,
+  SECTION_POSITIONS_Y,
+  SECTION_VELOCITIES_X,
+  SECTION_VELOCITIES_Y,
+  SECTION_RADII,
+  SECTION_ALIVE,
+  SECTION_RNG,
+  SECTION_COUNT,
+};
+
+constexpr char SNAPSHOT_MAGIC[4] = {'D', 'O', 'T', 'S'};
+constexpr uint64_t SNAPSHOT_ALIGNMENT = 64;
+
+struct SnapshotHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+  uint64_t aliveCount;
+  uint32_t screenWidth;
+  uint32_t screenHeight;
+  float accumulator;
+  int32_t stepsSinceReorder;
+  uint64_t offsets[SECTION_COUNT];
+  uint64_t sizes[SECTION_COUNT]; // bytes
+  uint64_t fileSize;
+};
+
+uint64_t alignSnapshotOffset(uint64_t offset) {
+  return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT *
+         SNAPSHOT_ALIGNMENT;
+}
+
+// read only view of a whole file, mapped where we can
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+      return;
+    m_buffer.assign(std::istreambuf_iterator<char>(file), {});
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        m_data = static_cast<const char *>(data);
+        m_size = info.st_size;
+      }
+    }
+    close(fd); // the mapping stays valid
+#endif
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (m_data != nullptr)
+      munmap(const_cast<char *>(m_data), m_size);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+#ifdef _WIN32
+  std::vector<char> m_buffer;
+#endif
+};
+} // namespace
+
+bool Dots::saveSnapshot(const std::string &path,
+                        const StepState &steps) const {
+  // the rng only exposes its state as text, it is a few kB
+  std::stringstream rngState;
+  rngState << rng;
+  const std::string rngText = rngState.str();
+
+  // alive indices are stored as 64 bit, whatever size_t is here
+  std::vector<uint64_t> alive(alive_indices.begin(), alive_indices.end());
+
+  SnapshotHeader header = {};
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.count = count;
+  header.aliveCount = alive.size();
+  header.screenWidth = Settings::SCREEN_WIDTH;
+  header.screenHeight = Settings::SCREEN_HEIGHT;
+  header.accumulator = steps.accumulator;
+  header.stepsSinceReorder = steps.stepsSinceReorder;
+
+  const void *sections[SECTION_COUNT] = {
+      positions_x.data(),  positions_y.data(), velocities_x.data(),
+      velocities_y.data(), radii.data(),       alive.data(),
+      rngText.data()};
+  header.sizes[SECTION_POSITIONS_X] = count * sizeof(float);
+  header.sizes[SECTION_POSITIONS_Y] = count * sizeof(float);
+  header.sizes[SECTION_VELOCITIES_X] = count * sizeof(float);
+  header.sizes[SECTION_VELOCITIES_Y] = count * sizeof(float);
+  header.sizes[SECTION_RADII] = count * sizeof(uint8_t);
+  header.sizes[SECTION_ALIVE] = alive.size() * sizeof(uint64_t);
+  header.sizes[SECTION_RNG] = rngText.size();
+
+  uint64_t offset = alignSnapshotOffset(sizeof(SnapshotHeader));
+  for (int s = 0; s < SECTION_COUNT; ++s) {
+    header.offsets[s] = offset;
+    offset = alignSnapshotOffset(offset + header.sizes[s]);
+  }
+  header.fileSize = offset;
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    Debug::LogError("[Dots] Could not open " + path);
+    return false;
+  }
+
+  const char padding[SNAPSHOT_ALIGNMENT] = {};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  uint64_t written = sizeof(header);
+  for (int s = 0; s < SECTION_COUNT; ++s) {
+    file.write(padding, header.offsets[s] - written);
+    file.write(static_cast<const char *>(sections[s]), header.sizes[s]);
+    written = header.offsets[s] + header.sizes[s];
+  }
+  file.write(padding, header.fileSize - written);
+
+  if (!file.good()) {
+    Debug::LogError("[Dots] Could not write " + path);
+    return false;
+  }
+  Debug::Log("[Dots] Snapshot saved to " + path);
+  return true;
+}
+
+bool Dots::loadSnapshot(const std::string &path, StepState *steps) {
+  MappedFile file(path);
+  if (file.data() == nullptr) {
+    Debug::LogError("[Dots] Could not open " + path);
+    return false;
+  }
+
+  // validate everything before touching the dots
+  SnapshotHeader header;
+  if (file.size() < sizeof(header)) {
+    Debug::LogError("[Dots] Snapshot is truncated: " + path);
+    return false;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != SNAPSHOT_VERSION) {
+    Debug::LogError("[Dots] Not a version " +
+                    std::to_string(SNAPSHOT_VERSION) + " snapshot: " + path);
+    return false;
+  }
+  if (header.fileSize > file.size()) {
+    Debug::LogError("[Dots] Snapshot is truncated: " + path);
+    return false;
+  }
+  const uint64_t expected[SECTION_COUNT] = {
+      header.count * sizeof(float),        header.count * sizeof(float),
+      header.count * sizeof(float),        header.count * sizeof(float),
+      header.count * sizeof(uint8_t),      header.aliveCount * sizeof(uint64_t),
+      header.sizes[SECTION_RNG]};
+  for (int s = 0; s < SECTION_COUNT; ++s) {
+    if (header.sizes[s] != expected[s] || header.offsets[s] > header.fileSize ||
+        header.sizes[s] > header.fileSize - header.offsets[s]) {
+      Debug::LogError("[Dots] Snapshot sections are broken: " + path);
+      return false;
+    }
+  }
+  if (header.screenWidth != Settings::SCREEN_WIDTH ||
+      header.screenHeight != Settings::SCREEN_HEIGHT)
+    Debug::LogWarning("[Dots] Snapshot was taken at another screen size");
+
+  count = header.count;
+  positions_x.resize(count);
+  positions_y.resize(count);
+  velocities_x.resize(count);
+  velocities_y.resize(count);
+  radii.resize(count);
+  alive.resize(count);
+
+  // no parsing, every array is one copy out of the mapping
+  const char *data = file.data();
+  memcpy(positions_x.data(), data + header.offsets[SECTION_POSITIONS_X],
+         header.sizes[SECTION_POSITIONS_X]);
+  memcpy(positions_y.data(), data + header.offsets[SECTION_POSITIONS_Y],
+         header.sizes[SECTION_POSITIONS_Y]);
+  memcpy(velocities_x.data(), data + header.offsets[SECTION_VELOCITIES_X],
+         header.sizes[SECTION_VELOCITIES_X]);
+  memcpy(velocities_y.data(), data + header.offsets[SECTION_VELOCITIES_Y],
+         header.sizes[SECTION_VELOCITIES_Y]);
+  memcpy(radii.data(), data + header.offsets[SECTION_RADII],
+         header.sizes[SECTION_RADII]);
+
+  alive_indices.resize(header.aliveCount);
+  if constexpr (sizeof(size_t) == sizeof(uint64_t)) {
+    memcpy(alive_indices.data(), data + header.offsets[SECTION_ALIVE],
+           header.sizes[SECTION_ALIVE]);
+  } else {
+    const char *alive = data + header.offsets[SECTION_ALIVE];
+    for (size_t i = 0; i < header.aliveCount; ++i) {
+      uint64_t index;
+      memcpy(&index, alive + i * sizeof(uint64_t), sizeof(index));
+      alive_indices[i] = static_cast<size_t>(index);
+    }
+  }
+  // indices past the end would be read out of bounds later on
+  std::erase_if(alive_indices,
+                [this](size_t index) { return index >= count; });
+
+  // the flags follow the stored alive set, dots that had already grown to
+  // death are dead either way
+  std::fill(alive.data(), alive.data() + count, uint8_t(0));
+  for (size_t index : alive_indices)
+    alive[index] = radii[index] < DEATH_RADIUS;
+  compact(nullptr);
+
+  ensureRngInit();
+  std::stringstream rngState(
+      std::string(data + header.offsets[SECTION_RNG], header.sizes[SECTION_RNG]));
+  rngState >> rng;
+  if (steps != nullptr) {
+    steps->accumulator = header.accumulator;
+    steps->stepsSinceReorder = header.stepsSinceReorder;
+  }
+
+  std::string dotsCountText = "DOTS_AMOUNT: " + std::to_string(count);
+  Debug::UpdateScreenField("DOTS", dotsCountText);
+  Debug::Log("[Dots] Snapshot loaded from " + path);
+  return true;
+}
+
 // Renders all the dots
 void Dots::renderAll(DotRenderer *aRenderer, Timer& timer) {
   aRenderer->BatchDrawCirclesCPUThreaded(
-    positions_x,
-    positions_y,
-    radii, 
+    positions_x.data(),
+    positions_y.data(),
+    radii.data(),
     alive_indices,
     timer);
 }
@@ -1,45 +1,173 @@
 #pragma once
+#include "AlignedArray.h"
 #include "glm/glm.hpp"
 #include <cstdint>
 #include <cstdio>
 #include <random>
+#include <string>
 #include "SimpleProfiler.h"
 
 class DotRenderer;
+class MortonOrder;
+class ThreadPool;
 
 class Dots {
 public:
-  static constexpr int MAX_DOTS = 25000; // 20000 * 17B = 340kB
+  static constexpr size_t DEFAULT_DOTS = 25000; // 25000 * 18B = 450kB
+  static constexpr size_t BYTES_PER_DOT =
+      4 * sizeof(float) + 2 * sizeof(uint8_t);
   static constexpr float VELOCITY = 50.f;
   static constexpr int RADIUS = 1;
+  static constexpr int DEATH_RADIUS = RADIUS + 3; // grown this far it dies
+  static constexpr size_t UPDATE_GRAIN = 16384; // dots per update chunk
+  static constexpr size_t COMPACT_GRAIN = 8192; // dots per compaction chunk
+  static constexpr uint32_t SNAPSHOT_VERSION = 2;
+  static constexpr int CLUSTER_COUNT = 8;
+  static constexpr float CLUSTER_SPREAD = 40.f; // px, standard deviation
+
+  enum class Scene {
+    Uniform,   // anywhere on the screen
+    Clustered, // around CLUSTER_COUNT fixed centers, respawns too
+  };
+
+  /// Where the fixed step loop stood, a snapshot keeps it next to the dots
+  /// so a loaded run steps and reorders on the same frames as the saved one
+  struct StepState {
+    float accumulator = 0.f;        // frame time that was not simulated yet
+    int32_t stepsSinceReorder = 0;
+  };
 
 private: // randomness
-  thread_local static std::mt19937 rng;
-  thread_local static std::uniform_real_distribution<float> angleDist;
-  thread_local static std::uniform_int_distribution<int> xDist;
-  thread_local static std::uniform_int_distribution<int> yDist;
-  thread_local static bool initialized;
+  // owned by the dots, not the thread, so respawns draw from the same
+  // generator whichever thread simulates, and snapshots can restore it
+  std::mt19937 rng;
+  std::uniform_real_distribution<float> angleDist;
+  std::uniform_int_distribution<int> xDist;
+  std::uniform_int_distribution<int> yDist;
+  bool rngInitialized = false;
+
+  // fixed seed for reproducible runs, time(nullptr) is used when unset
+  static bool useFixedSeed;
+  static uint32_t fixedSeed;
+
+  static Scene scene;
+  static float clusterX[CLUSTER_COUNT];
+  static float clusterY[CLUSTER_COUNT];
 
   void ensureRngInit();
+  /// Random position for a dot, from the scene
+  void placeDot(size_t index);
 
 public:
-  Dots();
+  /*
+   * Allocates storage for count dots, call init() to place them
+   *
+   * @param count The number of dots
+   */
+  explicit Dots(size_t count = DEFAULT_DOTS);
   ~Dots();
   void init();
 
   /*
-   * Re-Initializes a dot with new position and velocity
+   * Changes the number of dots at runtime. New dots are placed randomly,
+   * removed dots are taken off the end.
+   *
+   * @param count The new number of dots
+   */
+  void resize(size_t count);
+
+  /*
+   * Seeds the rng of every Dots with a fixed value instead of the current
+   * time. Must be called before init(), the rng is seeded on first use.
+   *
+   * @param seed The seed to use
+   */
+  static void setSeed(uint32_t seed);
+
+  /*
+   * Picks where dots are placed by init() and initDot(). The cluster
+   * centers come from the seed, so call it after setSeed.
+   *
+   * @param newScene The distribution to use
+   */
+  static void setScene(Scene newScene);
+
+  /*
+   * Re-Initializes a dot with new position and velocity, the dot is alive
+   * again afterwards
    *
    * @param index The index of the dot
    */
   void initDot(size_t index);
 
+  bool isAlive(size_t index) const { return alive[index] != 0; }
+
   /*
-  * Moves all dots by their velocities and updates bounces on borders
+   * Grows a dot after a collision, at DEATH_RADIUS it dies. Dead dots keep
+   * their slot and are skipped by the collisions until the next compact().
+   *
+   * @param index The index of the dot
+   */
+  void grow(size_t index) {
+    if (++radii[index] >= DEATH_RADIUS)
+      alive[index] = 0;
+  }
+
+  /*
+   * Rebuilds alive_indices and the dead_indices free-list from the alive
+   * flags. Every chunk of dots counts its alive and dead dots, a prefix sum
+   * over the chunks gives each one its write position, and the chunks then
+   * scatter in parallel. Both lists come out in ascending index order.
+   *
+   * @param threadPool The pool to split the chunks over, null runs serial
+   */
+  void compact(ThreadPool *threadPool) { compact(threadPool, alive.data(), 1); }
+  /*
+   * Same, but a dot counts as alive where flags[i] & aliveBit is set. The
+   * compact layout keeps its flag in the state byte.
+   */
+  void compact(ThreadPool *threadPool, const uint8_t *flags, uint8_t aliveBit);
+
+  /*
+   * Respawns every dot on the free-list with initDot and appends it to
+   * alive_indices. Runs serially on the rng of these dots, so a seeded run
+   * respawns the same way every time, whichever thread calls it.
+   *
+   * @return The number of respawned dots
+   */
+  size_t respawnDead();
+
+  /*
+   * Sorts the dots along a Z-order curve (see MortonOrder), so neighbours on
+   * screen are neighbours in memory. Every array is moved, and the alive set
+   * and free-list are rebuilt for the new indices. Indices kept anywhere
+   * else are stale afterwards, mortonOrder.getOrder() maps them.
+   *
+   * @param mortonOrder The sorter, keeps the order for other arrays
+   * @param threadPool The pool to split the work over
+   */
+  void sortByMorton(MortonOrder &mortonOrder, ThreadPool *threadPool);
+
+  /*
+  * Moves all dots by their velocities and updates bounces on borders. Runs
+  * a SIMD kernel over contiguous chunks of the SoA arrays on the pool.
+  *
+  * @param deltaTime deltaTime
+  * @param threadPool The pool to split the chunks over
+  */
+  void updateAll(float deltaTime, ThreadPool *threadPool);
+
+  /*
+  * Update kernel for the dots [begin, end). AVX2 moves 8 dots at a time and
+  * SSE 4 (see Simd::active), walls are handled with compare masks and blends
+  * instead of branches. The leftovers run through the same logic one at a
+  * time.
   *
+  * @param begin First dot index
+  * @param end One past the last dot index
   * @param deltaTime deltaTime
   */
-  void updateAll(float deltaTime);
+  void updateRange(size_t begin, size_t end, float deltaTime);
   /*
   * Renders every dot on the screen
   *
@@ -48,19 +176,55 @@ public:
   */
   void renderAll(DotRenderer *aRenderer, Timer& timer);
 
-  inline const size_t size() const { return MAX_DOTS; }
+  size_t size() const { return count; }
+
+  /*
+  * Writes every dot, the alive set, the respawn rng and the step state to
+  * a binary snapshot. Every array is stored raw at a 64 byte aligned
+  * offset, so loading is a memcpy per array.
+  *
+  * @param path The file to write
+  * @param steps Where the step loop stands
+  * @return false if the file could not be written
+  */
+  bool saveSnapshot(const std::string &path, const StepState &steps) const;
+  /*
+  * Restores a snapshot written by saveSnapshot. The file is memory mapped
+  * and copied straight into the arrays, the dot count comes from the file.
+  * The respawn rng is restored too, and with the step state the run
+  * continues exactly like the one that was saved.
+  *
+  * @param path The file to read
+  * @param steps Receives the saved step state, may be null
+  * @return false if the file is missing, truncated or of another version,
+  *         the dots are left untouched then
+  */
+  bool loadSnapshot(const std::string &path, StepState *steps = nullptr);
+
+private:
+  size_t count;
+  /// Vector part of updateRange, returns the first dot it left for the
+  /// scalar leftovers
+  size_t updateRangeAVX2(size_t begin, size_t end, float step);
+  size_t updateRangeSSE4(size_t begin, size_t end, float step);
 
 public:
-  float positions_x[MAX_DOTS];  // 4B
-  float positions_y[MAX_DOTS];  // 4B
-  float velocities_x[MAX_DOTS]; // 4B
-  float velocities_y[MAX_DOTS]; // 4B
-  uint8_t radii[MAX_DOTS];      // 1B per
+  // 64-byte aligned SoA, sized at runtime
+  AlignedArray<float> positions_x;  // 4B
+  AlignedArray<float> positions_y;  // 4B
+  AlignedArray<float> velocities_x; // 4B
+  AlignedArray<float> velocities_y; // 4B
+  AlignedArray<uint8_t> radii;      // 1B per
+  AlignedArray<uint8_t> alive;      // 1B per, 0 once the dot died
 
 public:
   // keeping track of dead and alive indices means we can
   // entirely skip over instructions at every part of the
   // pipeline increasing performance (culling)
-  std::vector<size_t> alive_indices;
-  std::vector<size_t> dead_indices;
+  std::vector<size_t> alive_indices; // dense, rebuilt by compact()
+  std::vector<size_t> dead_indices;  // free-list, drained by respawnDead()
+
+private:
+  std::vector<uint32_t> chunkAlive; // compaction counts, then offsets
+  std::vector<uint32_t> chunkDead;
 };
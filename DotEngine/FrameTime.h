@@ -1,57 +1,148 @@
 #pragma once
-#include "Debug.h"
-#include <cstring>
 #include <algorithm>
-#include <string>
-#include <iostream>
+#include <cstdint>
 #include <vector>
 
+/*
+ * Log bucketed histogram of frame times (HDR style). Values are recorded in
+ * microseconds, every power of two range is split into 64 linear buckets, so
+ * a percentile is off by at most 1/64 (1.6%) of its value. Recording is
+ * constant time. With a window size the histogram only holds the last
+ * windowSize frames, the oldest frame is taken out again on every record.
+ */
+class FrameHistogram {
+public:
+  static constexpr int SUB_BUCKET_BITS = 7;
+  static constexpr uint32_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS; // 128
+  static constexpr uint32_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+  static constexpr uint32_t MAX_US = 60u * 1000u * 1000u; // clamp at 60 s
+  static constexpr int BUCKET_COUNT =
+      (32 - SUB_BUCKET_BITS + 1) * HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+
+  /// @param windowSize Frames kept in the histogram, 0 keeps all of them
+  explicit FrameHistogram(uint32_t windowSize = 0)
+      : m_counts(BUCKET_COUNT, 0), m_window(windowSize, 0) {}
+
+  void Record(float ms) {
+    const uint32_t us =
+        static_cast<uint32_t>(std::clamp(ms * 1000.f, 0.f, float(MAX_US)));
+
+    // sliding window, take the frame that falls out back out
+    if (!m_window.empty()) {
+      if (m_count == m_window.size())
+        m_counts[BucketIndex(m_window[m_next])]--;
+      else
+        m_count++;
+      m_window[m_next] = us;
+      m_next = (m_next + 1) % m_window.size();
+    } else {
+      m_count++;
+    }
+
+    m_counts[BucketIndex(us)]++;
+    m_recorded++;
+    m_totalUs += us;
+    m_maxUs = std::max(m_maxUs, us);
+  }
+
+  /*
+   * Walks the buckets up to the one holding the q-th fraction of frames
+   *
+   * @param q Fraction between 0 and 1, 0.99 for p99
+   * @return The frame time in ms, the middle of the matching bucket
+   */
+  float Percentile(float q) const {
+    if (m_count == 0)
+      return 0.f;
+    // rank of the frame we are after, 1 based
+    const uint64_t rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(q * m_count + 0.999999));
+    // never report more than the worst frame
+    const float maxMs = Max();
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+      seen += m_counts[i];
+      if (seen >= rank)
+        return std::min(BucketMiddle(i) / 1000.f, maxMs);
+    }
+    return maxMs;
+  }
+
+  /// Worst frame in the window, exact
+  float Max() const {
+    if (m_window.empty())
+      return m_maxUs / 1000.f;
+    uint32_t maxUs = 0;
+    for (size_t i = 0; i < m_count; ++i)
+      maxUs = std::max(maxUs, m_window[i]);
+    return maxUs / 1000.f;
+  }
+
+  /// Mean of every frame ever recorded, not just the window
+  float Mean() const {
+    return m_recorded > 0 ? float(m_totalUs) / m_recorded / 1000.f : 0.f;
+  }
+
+  uint64_t Count() const { return m_count; }
 
-class FrameTime{
 private:
-  const int MAX_FRAMES = 1000;
-  const float REFRESH_RATE = 0.5f ;
+  static int BucketIndex(uint32_t us) {
+    if (us < SUB_BUCKETS)
+      return static_cast<int>(us);
+    // shift so the value lands in [64, 128), every shift adds 64 buckets
+    const int shift = (32 - __builtin_clz(us)) - SUB_BUCKET_BITS;
+    return shift * HALF_SUB_BUCKETS + static_cast<int>(us >> shift);
+  }
+
+  static float BucketMiddle(int index) {
+    if (index < static_cast<int>(SUB_BUCKETS))
+      return static_cast<float>(index);
+    const int shift = index / HALF_SUB_BUCKETS - 1;
+    const uint32_t sub = index - shift * HALF_SUB_BUCKETS;
+    return float(sub << shift) + float((1u << shift) - 1) / 2.f;
+  }
 
+  std::vector<uint32_t> m_counts;
+  std::vector<uint32_t> m_window; // ring of the last frames in us
+  size_t m_next = 0;
+  uint64_t m_count = 0;    // frames in the histogram
+  uint64_t m_recorded = 0; // frames ever recorded
+  uint64_t m_totalUs = 0;
+  uint32_t m_maxUs = 0;
+};
+
+class FrameTime{
+private:
+  static constexpr uint32_t WINDOW_FRAMES = 1000;
+  const float REFRESH_RATE = 0.5f;
 
-  float frameTimes[1000];
-  std::vector<float> frameTimesNew;
-  int currentIndex = 0;
+  FrameHistogram window{WINDOW_FRAMES};
   float acc = 0.f;
 
-public: 
-  float onepercentlow = 0.0f;
-  FrameTime() : currentIndex(0) {
-    memset(frameTimes, 0, sizeof(float)*MAX_FRAMES);
-  }
+public:
+  // over the last WINDOW_FRAMES frames, refreshed every REFRESH_RATE seconds
+  float p50 = 0.f;
+  float p90 = 0.f;
+  float p99 = 0.f;
+  float p999 = 0.f;
+  float max = 0.f;
 
   void Update(float dt){
-    frameTimes[currentIndex] = dt * 1000;
-    frameTimesNew.push_back(dt*1000);
-    currentIndex = (currentIndex + 1) % MAX_FRAMES;
-
-    if(frameTimesNew.size() >= MAX_FRAMES)
-      frameTimesNew.erase(frameTimesNew.begin());
+    window.Record(dt * 1000.f);
 
     acc += dt;
     if(acc >= REFRESH_RATE){
       acc = 0.f;
-      Update1PercentLows();
+      UpdatePercentiles();
     }
   }
 
 private:
-  void Update1PercentLows(){
-
-    std::vector<float> tempVct = frameTimesNew;
-    std::sort(tempVct.begin(), tempVct.end());
-
-    int worst_count = frameTimesNew.size() * 0.1f;
-    float totalWorst = 0.0f;
-    for(int i=0; i<worst_count; ++i){
-      totalWorst += tempVct[i];
-    }
-
-    float avgWorst = totalWorst / worst_count;
-    onepercentlow = avgWorst > 0.0f ? avgWorst : 0.0f;
+  void UpdatePercentiles(){
+    p50 = window.Percentile(0.5f);
+    p90 = window.Percentile(0.9f);
+    p99 = window.Percentile(0.99f);
+    p999 = window.Percentile(0.999f);
+    max = window.Max();
   }
 };
@@ -1,15 +1,18 @@
 #include "Game.h"
 #include "Debug.h"
 #include "DotRenderer.h"
+#include "NarrowPhase.h"
+#include "ScopeProfiler.h"
 #include "SimpleProfiler.h"
 #include "ThreadPool.h"
 #include <cstdlib>
+#include <cstring>
 #include <mutex>
-#include <immintrin.h>
 
-Game::Game(DotRenderer *aRenderer, ThreadPool *threadPool, Timer &timer)
-    : renderer(aRenderer), threadPool(threadPool), timer(timer),
-      dots_mutexes(Dots::MAX_DOTS) {
+Game::Game(DotRenderer *aRenderer, ThreadPool *threadPool, Timer &timer,
+           size_t dotCount)
+    : dots(dotCount), renderer(aRenderer), timer(timer),
+      threadPool(threadPool) {
   dots.init();
 
   // Color settings for debug
@@ -21,125 +24,569 @@ Game::Game(DotRenderer *aRenderer, ThreadPool *threadPool, Timer &timer)
   Debug::UpdateKeySettings("Dots_Render", settings);
 
   grid.rebuild(dots);
+  resetInterpolation();
+  writeSnapshot(snapshots[frontSnapshot]);
 }
 
-Game::~Game() {}
+Game::~Game() {
+  if (simThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(simMutex);
+      simQuit = true;
+    }
+    simCondition.notify_all();
+    simThread.join();
+  }
+}
+
+void Game::resizeDots(size_t count) {
+  syncFloatDots();
+  dots.resize(count);
+  if (dotLayout == DotLayout::Compact)
+    compactDots.pack(dots);
+  // the mutexes are made again the next time locked collisions run
+  std::vector<std::mutex>().swap(dots_mutexes);
+  grid.rebuild(dots, threadPool);
+  resetInterpolation();
+}
+
+bool Game::saveDots(const std::string &path) {
+  syncFloatDots();
+  return dots.saveSnapshot(path, {accumulator, stepsSinceReorder});
+}
+
+void Game::setDotLayout(DotLayout layout) {
+  if (layout == dotLayout)
+    return;
+  if (layout == DotLayout::Compact)
+    compactDots.pack(dots);
+  else
+    compactDots.unpack(dots);
+  dotLayout = layout;
+
+  // quantizing moved the dots a little
+  if (layout == DotLayout::Compact)
+    grid.rebuild(compactDots, dots.alive_indices, threadPool);
+  else
+    grid.rebuild(dots, threadPool);
+  resetInterpolation();
+}
+
+void Game::syncFloatDots() {
+  if (dotLayout == DotLayout::Compact)
+    compactDots.unpack(dots);
+}
+
+bool Game::loadDots(const std::string &path) {
+  Dots::StepState steps;
+  if (!dots.loadSnapshot(path, &steps))
+    return false;
+  // a step never leaves a whole step in the accumulator, the step size may
+  // differ from the saved run though
+  accumulator = std::clamp(steps.accumulator, 0.f, fixedStep);
+  stepsSinceReorder = steps.stepsSinceReorder;
+  if (dotLayout == DotLayout::Compact)
+    compactDots.pack(dots);
+  // same as a resize, the dot count may have changed
+  std::vector<std::mutex>().swap(dots_mutexes);
+  grid.rebuild(dots, threadPool);
+  // the positions before the last step are not saved, the first frame is
+  // drawn without interpolation
+  resetInterpolation();
+  writeSnapshot(snapshots[frontSnapshot]);
+  return true;
+}
 
 void Game::Update(float aDeltaTime) {
+  PROFILE_SCOPE("update_total");
   auto &t_total = timer.startChild("update_total");
 
+  advance(t_total, aDeltaTime);
+
+  // Render all the dots, headless runs may not have a renderer at all
+  auto &t_render = t_total.startChild("dots_render");
+  if (renderer) {
+    writeSnapshot(snapshots[frontSnapshot]);
+    renderSnapshot(snapshots[frontSnapshot], t_render);
+  }
+  t_render.stopClock();
+  t_total.stopClock();
+
+  t_lastRender = &t_render;
+  updateDebugFields();
+}
+
+void Game::setFixedStep(float step, int substeps) {
+  fixedStep = step;
+  maxSubsteps = std::max(1, substeps);
+  accumulator = 0.f;
+}
+
+int Game::advance(Timer &t_total, float aDeltaTime) {
+  // cap the frame, so one slow frame can't snowball
+  accumulator += std::min(aDeltaTime, fixedStep * maxSubsteps);
+
+  int substeps = 0;
+  while (accumulator >= fixedStep) {
+    // the step before the last one is where interpolation starts from
+    previous_x.resize(dots.size());
+    previous_y.resize(dots.size());
+    copyPositions(previous_x.data(), previous_y.data());
+
+    simulate(t_total, fixedStep);
+    accumulator -= fixedStep;
+    substeps++;
+  }
+
+  interpolationAlpha = accumulator / fixedStep;
+  return substeps;
+}
+
+void Game::resetInterpolation() {
+  previous_x.resize(dots.size());
+  previous_y.resize(dots.size());
+  copyPositions(previous_x.data(), previous_y.data());
+  interpolationAlpha = 1.f;
+}
+
+void Game::copyPositions(float *out_x, float *out_y) const {
+  if (dotLayout == DotLayout::Compact) {
+    compactDots.unpackPositions(out_x, out_y);
+    return;
+  }
+  memcpy(out_x, dots.positions_x.data(), dots.size() * sizeof(float));
+  memcpy(out_y, dots.positions_y.data(), dots.size() * sizeof(float));
+}
+
+void Game::simulate(Timer &t_total, float aDeltaTime) {
   // cull dots first
   cullDots(t_total);
 
+  // every dot is alive after the culling, so this is where the order is
+  // cheapest to change
+  if (reorderInterval > 0 && ++stepsSinceReorder >= reorderInterval) {
+    stepsSinceReorder = 0;
+    reorderDots(t_total);
+  }
+
+  // the compact layout has no per dot locks and no float positions for the
+  // broadphases, it always runs phased
+  const bool compact = dotLayout == DotLayout::Compact;
+  const CollisionMode mode = getEffectiveCollisionMode();
+
+  // pairs mode builds its own structure, after the update
   auto &t_rebuild = t_total.startChild("grid_build");
-  grid.rebuild(dots);
+  if (compact)
+    grid.update(compactDots, dots.alive_indices, threadPool);
+  else if (mode != CollisionMode::Pairs)
+    grid.update(dots, threadPool);
   t_rebuild.stopClock();
 
+  if (verifyGrid && mode != CollisionMode::Pairs) {
+    if (compact)
+      referenceGrid.rebuild(compactDots, dots.alive_indices, nullptr);
+    else
+      referenceGrid.rebuild(dots);
+    if (!grid.sameContents(referenceGrid))
+      Debug::LogError("[Game] Parallel grid rebuild differs from serial");
+  }
+
   // Update all the dots positions
   auto &t_updateDots = t_total.startChild("dots_update");
-  dots.updateAll(aDeltaTime);
+  if (compact)
+    compactDots.updateAll(aDeltaTime, threadPool);
+  else
+    dots.updateAll(aDeltaTime, threadPool);
   t_updateDots.stopClock();
 
   // Process all collisions
   auto &t_collision = t_total.startChild("dots_collision");
-  processCollisions_threaded(t_collision);
+  if (mode == CollisionMode::Phased)
+    processCollisions_phased();
+  else if (mode == CollisionMode::Pairs)
+    processCollisions_pairs(t_collision);
+  else
+    processCollisions_threaded();
   t_collision.stopClock();
+}
 
-  // Render all the dots
-  auto &t_render = t_total.startChild("dots_render");
-  dots.renderAll(renderer, t_render);
+void Game::reorderDots(Timer &t_total) {
+  PROFILE_SCOPE("reorder");
+  auto &t_reorder = t_total.startChild("reorder");
+  if (dotLayout == DotLayout::Compact) {
+    compactDots.sortByMorton(mortonOrder, threadPool);
+    dots.compact(threadPool, compactDots.states.data(), CompactDots::ALIVE_BIT);
+  } else {
+    dots.sortByMorton(mortonOrder, threadPool);
+  }
+
+  // the interpolation start has to follow its dots
+  mortonOrder.apply(previous_x, threadPool);
+  mortonOrder.apply(previous_y, threadPool);
+  // every dot the grid and the pair cache track changed index
+  grid.invalidate();
+  broadphase->invalidate();
+  t_reorder.stopClock();
+}
+
+double Game::measureLocality() {
+  if (dotLayout == DotLayout::Compact)
+    referenceGrid.rebuild(compactDots, dots.alive_indices, threadPool);
+  else
+    referenceGrid.rebuild(dots, threadPool);
+  return referenceGrid.getMeanIndexDistance(threadPool);
+}
+
+void Game::writeSnapshot(RenderSnapshot &snapshot) const {
+  PROFILE_SCOPE("write_snapshot");
+  const size_t count = dots.size();
+  snapshot.positions_x.resize(count);
+  snapshot.positions_y.resize(count);
+  snapshot.radii.resize(count);
+
+  // positions in between the last two steps, by how far into the next step
+  // the accumulator already is
+  const float alpha = interpolationAlpha;
+  const float *prevX = previous_x.data();
+  const float *prevY = previous_y.data();
+  float *outX = snapshot.positions_x.data();
+  float *outY = snapshot.positions_y.data();
+  copyPositions(outX, outY);
+  for (size_t i = 0; i < count; i++) {
+    const float dx = outX[i] - prevX[i];
+    const float dy = outY[i] - prevY[i];
+    // respawned dots jump, draw them where they are now
+    const bool snap = dx * dx + dy * dy > SNAP_DISTANCE * SNAP_DISTANCE;
+    outX[i] = snap ? outX[i] : prevX[i] + dx * alpha;
+    outY[i] = snap ? outY[i] : prevY[i] + dy * alpha;
+  }
+  if (dotLayout == DotLayout::Compact)
+    compactDots.unpackRadii(snapshot.radii.data());
+  else
+    memcpy(snapshot.radii.data(), dots.radii.data(), count * sizeof(uint8_t));
+  snapshot.alive_indices = dots.alive_indices;
+}
+
+void Game::beginFrame(float aDeltaTime) {
+  if (!simThread.joinable())
+    simThread = std::thread(&Game::simulationLoop, this);
+
+  {
+    std::lock_guard<std::mutex> lock(simMutex);
+    simDeltaTime = aDeltaTime;
+    simRequested = true;
+    simBusy = true;
+  }
+  simCondition.notify_all();
+}
+
+void Game::renderFrame(Timer &renderTimer) {
+  auto &t_render = renderTimer.startChild("dots_render");
+  if (renderer)
+    renderSnapshot(snapshots[frontSnapshot], t_render);
   t_render.stopClock();
-  t_total.stopClock();
+  t_lastRender = &t_render;
+}
+
+void Game::renderSnapshot(const RenderSnapshot &snapshot, Timer &t_render) {
+  // the renderer takes mutable arrays but only reads them
+  auto &frame = const_cast<RenderSnapshot &>(snapshot);
+  renderer->BatchDrawCirclesCPUThreaded(
+      frame.positions_x.data(), frame.positions_y.data(), frame.radii.data(),
+      frame.alive_indices, t_render);
+}
+
+void Game::endFrame() {
+  {
+    std::unique_lock<std::mutex> lock(simMutex);
+    simCondition.wait(lock, [this] { return !simBusy; });
+  }
+  // the step that just finished is what gets rendered next
+  frontSnapshot = 1 - frontSnapshot;
+  updateDebugFields();
+}
 
+void Game::simulationLoop() {
+  ScopeProfiler::SetThreadName("simulation");
+  std::unique_lock<std::mutex> lock(simMutex);
+  while (true) {
+    simCondition.wait(lock, [this] { return simRequested || simQuit; });
+    if (simQuit)
+      return;
+    simRequested = false;
+    const float deltaTime = simDeltaTime;
+    lock.unlock();
+
+    {
+      PROFILE_SCOPE("update_total");
+      auto &t_total = timer.startChild("update_total");
+      advance(t_total, deltaTime);
+      auto &t_snapshot = t_total.startChild("snapshot");
+      writeSnapshot(snapshots[1 - frontSnapshot]);
+      t_snapshot.stopClock();
+      t_total.stopClock();
+    }
+
+    lock.lock();
+    simBusy = false;
+    simCondition.notify_all();
+  }
+}
+
+void Game::updateDebugFields() {
   // ####################
   // ## DEBUG TIMINGS: ##
   // ####################
-  static int frame = 0;
-  if (++frame % 60 == 0) {
-    Debug::UpdateScreenField("Grid_Build",
-                             t_rebuild.getSimpleReport("Grid_Build"));
-    Debug::UpdateScreenField("Dots_Update",
-                             t_updateDots.getSimpleReport("Dots_Update"));
-    Debug::UpdateScreenField("Dots_Collision",
-                             t_collision.getSimpleReport("Dots_Collision"));
+  if (++debugFrame % 60 != 0)
+    return;
+
+  auto &t_total = timer.name_childTimer["update_total"];
+  Debug::UpdateScreenField(
+      "Grid_Build",
+      t_total.name_childTimer["grid_build"].getSimpleReport("Grid_Build"));
+  Debug::UpdateScreenField(
+      "Dots_Update",
+      t_total.name_childTimer["dots_update"].getSimpleReport("Dots_Update"));
+  Debug::UpdateScreenField("Dots_Collision",
+                           t_total.name_childTimer["dots_collision"]
+                               .getSimpleReport("Dots_Collision"));
+  if (t_lastRender)
     Debug::UpdateScreenField("Dots_Render",
-                             t_render.getSimpleReport("Dots_Render"));
-  }
+                             t_lastRender->getSimpleReport("Dots_Render"));
 }
 
 void Game::cullDots(Timer &timer) {
+  PROFILE_SCOPE("culling");
   auto &t_culling = timer.startChild("culling");
 
-  auto &t_startThreads = t_culling.startChild("start_threads");
-  const size_t numThreads = threadPool->num_threads;
-  const size_t totalAlive = dots.alive_indices.size();
-  const size_t dotsPerThread = totalAlive / numThreads;
-
-  // parallelize culling
-  for (size_t t = 0; t < numThreads; ++t) {
-    size_t start = t * dotsPerThread;
-    size_t end = (t == 0) ? totalAlive : start + dotsPerThread;
-
-    threadPool->queueJob([this, start, end] {
-      for (size_t i = start; i < end; ++i) {
-        if (dots.radii[i] >= Dots::RADIUS + 3)
-          dots.initDot(i);
-      }
-    });
+  // split the dots that died last step off into the free-list, then bring
+  // them back, everything after this only sees live dots
+  if (dotLayout == DotLayout::Compact) {
+    dots.compact(threadPool, compactDots.states.data(), CompactDots::ALIVE_BIT);
+    // respawned dots get their values in the float layout first
+    const size_t firstRespawned = dots.alive_indices.size();
+    dots.respawnDead();
+    for (size_t k = firstRespawned; k < dots.alive_indices.size(); k++)
+      compactDots.packDot(dots, dots.alive_indices[k]);
+  } else {
+    dots.compact(threadPool);
+    dots.respawnDead();
   }
-  t_startThreads.stopClock();
-
-  auto &t_waitThreads = t_culling.startChild("wait_for_threads");
-  threadPool->wait();
-  t_waitThreads.stopClock();
 
   t_culling.stopClock();
 }
 
-void Game::processCollisions_threaded(Timer &timer) {
-  auto &t_startThreads = timer.startChild("start_threads");
-
-  // split grid up into columns
-  const int nThreads = threadPool->num_threads;
-  const size_t colsPerThread = grid.GRID_WIDTH / nThreads;
-
-  // for each thread ...
-  for (int t = 0; t < nThreads; t++) {
-    // give them a bounded region in the grid
-    size_t start = colsPerThread * t;
-    size_t end = (t == nThreads) ? grid.GRID_WIDTH : start + colsPerThread;
-
-    // queue job
-    threadPool->queueJob([this, start, end] {
-      // iterate through rows and columns in region
-      for (size_t row = 0; row < SpatialGrid::GRID_HEIGHT; row++) {
-        for (size_t col = start; col < end; col++) {
-          SpatialGrid::Cell cell = grid.Grid[row][col];
-
-          // iterate through dot indexes in cell
-          for (int index = 0; index < cell.count; index++) {
-            size_t i1 = cell.indices[index];
-            float radius = dots.radii[index];
-
-            // query neighbours
-            grid.queryNeighbours(dots.positions_x[i1], dots.positions_y[i1],
-                                 radius, [&](size_t i2) {
-                                   if (i1 != i2 && i2 > i1 &&
-                                       dots.radii[i2] < Dots::RADIUS + 3) {
-                                     collideDotsSIMD(i1, i2);
-                                   }
-                                 });
+void Game::processCollisions_threaded() {
+  PROFILE_SCOPE("dots_collision");
+  // only locked collisions need a mutex per dot, so they are made lazily
+  if (dots_mutexes.size() != dots.size())
+    std::vector<std::mutex>(dots.size()).swap(dots_mutexes);
+
+  // one chunk per grid column, clustered columns get stolen by idle workers
+  threadPool->parallel_for(0, SpatialGrid::GRID_WIDTH, 1, [this](size_t start,
+                                                                 size_t end) {
+    // iterate through rows and columns in region
+    for (size_t row = 0; row < SpatialGrid::GRID_HEIGHT; row++) {
+      for (size_t col = start; col < end; col++) {
+        // iterate through dot indexes in cell
+        for (size_t i1 : grid.cell(col, row)) {
+          // neighbouring columns push this dot too, read it under its lock
+          float x, y, radius;
+          {
+            std::lock_guard<std::mutex> lock(dots_mutexes[i1]);
+            if (!dots.isAlive(i1))
+              continue;
+            x = dots.positions_x[i1];
+            y = dots.positions_y[i1];
+            radius = dots.radii[i1];
           }
+
+          // query neighbours
+          grid.queryNeighbours(x, y, radius, [&](size_t i2) {
+            if (i2 > i1)
+              collideDotsSIMD(i1, i2);
+          });
         }
       }
-    });
+    }
+  });
+}
+
+void Game::processCollisions_phased() {
+  PROFILE_SCOPE("dots_collision");
+  constexpr int BLOCK_SIZE = 2;
+  constexpr int BLOCKS_X = (SpatialGrid::GRID_WIDTH + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  constexpr int BLOCKS_Y = (SpatialGrid::GRID_HEIGHT + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  for (int phase = 0; phase < 4; phase++) {
+    const int phaseX = phase & 1;
+    const int phaseY = phase >> 1;
+    // every other block in both directions, starting at the phase offset
+    const int phaseBlocksX = (BLOCKS_X - phaseX + 1) / 2;
+    const int phaseBlocksY = (BLOCKS_Y - phaseY + 1) / 2;
+
+    threadPool->parallel_for(
+        0, phaseBlocksX * phaseBlocksY, PHASE_GRAIN,
+        [this, phaseX, phaseY, phaseBlocksX](size_t start, size_t end) {
+          for (size_t block = start; block < end; block++) {
+            const int bx = phaseX + 2 * static_cast<int>(block % phaseBlocksX);
+            const int by = phaseY + 2 * static_cast<int>(block / phaseBlocksX);
+
+            for (int gy = by * BLOCK_SIZE;
+                 gy < std::min((by + 1) * BLOCK_SIZE, SpatialGrid::GRID_HEIGHT);
+                 gy++) {
+              for (int gx = bx * BLOCK_SIZE;
+                   gx < std::min((bx + 1) * BLOCK_SIZE, SpatialGrid::GRID_WIDTH);
+                   gx++) {
+                collideCell(gx, gy);
+              }
+            }
+          }
+        });
+  }
+}
+
+void Game::processCollisions_pairs(Timer &t_collision) {
+  PROFILE_SCOPE("dots_collision");
+  auto &t_broadphase = t_collision.startChild("broadphase");
+  broadphase->findPairs(dots, threadPool, candidatePairs);
+  t_broadphase.stopClock();
+
+  PROFILE_SCOPE("resolve_pairs");
+  auto &t_resolve = t_collision.startChild("resolve");
+  for (const CandidatePair &pair : candidatePairs) {
+    // either dot may have died on an earlier pair
+    if (dots.isAlive(pair.a) && dots.isAlive(pair.b))
+      collideDotsUnlocked(pair.a, pair.b);
   }
-  t_startThreads.stopClock();
+  t_resolve.stopClock();
+}
+
+void Game::setBroadphase(Broadphase::Type type) {
+  if (type == broadphase->type())
+    return;
+  broadphase = Broadphase::create(type);
+  if (auto *cached = dynamic_cast<CachedGridBroadphase *>(broadphase.get()))
+    cached->setMargin(pairCacheMargin);
+}
+
+void Game::setPairCacheMargin(float margin) {
+  pairCacheMargin = margin;
+  if (auto *cached = dynamic_cast<CachedGridBroadphase *>(broadphase.get()))
+    cached->setMargin(margin);
+}
 
-  // waiting... 😴💤
-  auto &t_waitForThreads = timer.startChild("wait_for_threads");
-  threadPool->wait();
-  t_waitForThreads.stopClock();
+PairCacheStats Game::getPairCacheStats() const {
+  if (auto *cached =
+          dynamic_cast<const CachedGridBroadphase *>(broadphase.get()))
+    return cached->getStats();
+  return {};
+}
+
+void Game::gatherCell(int gx, int gy, DotBatch &batch) const {
+  batch.clear();
+  if (dotLayout == DotLayout::Compact) {
+    for (uint32_t index : grid.cell(gx, gy)) {
+      if (!compactDots.isAlive(index))
+        continue;
+      batch.push(index, compactDots.x(index), compactDots.y(index),
+                 compactDots.radius(index));
+    }
+    batch.pad();
+    return;
+  }
+  for (uint32_t index : grid.cell(gx, gy)) {
+    // dots that died earlier this step
+    if (!dots.isAlive(index))
+      continue;
+    batch.push(index, dots.positions_x[index], dots.positions_y[index],
+               dots.radii[index]);
+  }
+  batch.pad();
+}
+
+void Game::resolveContacts(DotBatch &home, uint32_t slot, DotBatch &other,
+                           const uint32_t *hits, uint32_t hitCount) {
+  const size_t i1 = home.index[slot];
+  for (uint32_t h = 0; h < hitCount; h++) {
+    const uint32_t otherSlot = hits[h];
+    const size_t i2 = other.index[otherSlot];
+
+    // the response checks again on the live data, earlier hits may have
+    // moved either dot
+    if (dotLayout == DotLayout::Compact) {
+      compactDots.collide(i1, i2);
+      other.set(otherSlot, compactDots.x(i2), compactDots.y(i2),
+                compactDots.radius(i2), compactDots.isAlive(i2));
+      bool alive = compactDots.isAlive(i1);
+      home.set(slot, compactDots.x(i1), compactDots.y(i1),
+               compactDots.radius(i1), alive);
+      if (!alive)
+        return;
+      continue;
+    }
+    collideDotsUnlocked(i1, i2);
+
+    // keep both batches in sync with the dots that were just moved
+    other.set(otherSlot, dots.positions_x[i2], dots.positions_y[i2],
+              dots.radii[i2], dots.isAlive(i2));
+    bool alive = dots.isAlive(i1);
+    home.set(slot, dots.positions_x[i1], dots.positions_y[i1], dots.radii[i1],
+             alive);
+    if (!alive)
+      return;
+  }
+}
+
+void Game::collideCell(int gx, int gy) {
+  PROFILE_SCOPE("collide_cell");
+  // half stencil, the other four neighbours reach this cell through theirs
+  static constexpr int HALF_STENCIL[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+  // scratch space, one set per thread
+  thread_local DotBatch home;
+  thread_local DotBatch other;
+  thread_local std::vector<uint32_t> hits;
+
+  gatherCell(gx, gy, home);
+  if (home.count == 0)
+    return;
+  if (hits.size() < home.count)
+    hits.resize(home.count);
+
+  // pairs inside the cell, every dot only tests the slots after it
+  for (uint32_t a = 0; a + 1 < home.count; a++) {
+    if (home.x[a] == DotBatch::SENTINEL)
+      continue;
+    uint32_t start = a + 1;
+    uint32_t hitCount = NarrowPhase::findContacts(
+        home.x[a], home.y[a], home.r[a], &home.x[start], &home.y[start],
+        &home.r[start], home.count - start, start, hits.data());
+    resolveContacts(home, a, home, hits.data(), hitCount);
+  }
+
+  // pairs with the neighbouring cells
+  for (const auto &offset : HALF_STENCIL) {
+    const int nx = gx + offset[0];
+    const int ny = gy + offset[1];
+    if (nx < 0 || nx >= SpatialGrid::GRID_WIDTH || ny >= SpatialGrid::GRID_HEIGHT)
+      continue;
+
+    gatherCell(nx, ny, other);
+    if (other.count == 0)
+      continue;
+    if (hits.size() < other.count)
+      hits.resize(other.count);
+
+    for (uint32_t a = 0; a < home.count; a++) {
+      if (home.x[a] == DotBatch::SENTINEL)
+        continue;
+      uint32_t hitCount = NarrowPhase::findContacts(
+          home.x[a], home.y[a], home.r[a], other.x.data(), other.y.data(),
+          other.r.data(), other.count, 0, hits.data());
+      resolveContacts(home, a, other, hits.data(), hitCount);
+    }
+  }
 }
 
 void Game::collideDots(size_t i1, size_t i2) {
@@ -220,104 +667,49 @@ void Game::collideDots(size_t i1, size_t i2) {
   dots.positions_x[i2] = p2_x + normal_x * overlap;
   dots.positions_y[i2] = p2_y + normal_y * overlap;
 
-  dots.radii[i1] = r1 + 1;
-  dots.radii[i2] = r2 + 1;
+  dots.grow(i1);
+  dots.grow(i2);
 }
 
-// Add this include at the top of Game.cpp if it's not already there
-
-// Replace your existing collideDots function with this one
 void Game::collideDotsSIMD(size_t i1, size_t i2) {
-  // --- 1. Load Data into SIMD Registers ---
-  // Pack positions and velocities into 128-bit registers.
-  // Layout: [y2, x2, y1, x1]
-  __m128 pos = _mm_set_ps(dots.positions_y[i2], dots.positions_x[i2],
-                          dots.positions_y[i1], dots.positions_x[i1]);
-  __m128 vel = _mm_set_ps(dots.velocities_y[i2], dots.velocities_x[i2],
-                          dots.velocities_y[i1], dots.velocities_x[i1]);
-
-  // --- 2. Calculate Distance and Perform Early Exit Check ---
-  // Subtract the lower half [y1, x1] from the upper half [y2, x2]
-  __m128 diff = _mm_sub_ps(_mm_movehl_ps(pos, pos), pos);
-
-  // Calculate dot product of diff with itself (diff.x^2 + diff.y^2)
-  // The 0x31 mask means: multiply lanes 0 and 1, sum them, and store the result
-  // in lane 0.
-  __m128 distSq_v = _mm_dp_ps(diff, diff, 0x31);
-  float distSq = _mm_cvtss_f32(distSq_v); // Convert SIMD float to scalar float
+  collideDotsImpl<true>(i1, i2);
+}
 
-  uint8_t r1 = dots.radii[i1];
-  uint8_t r2 = dots.radii[i2];
-  float minDist = r1 + r2;
+void Game::collideDotsUnlocked(size_t i1, size_t i2) {
+  collideDotsImpl<false>(i1, i2);
+}
 
-  if (distSq >= minDist * minDist || distSq < 0.01f)
-    return;
+template <bool Locked> void Game::collideDotsImpl(size_t i1, size_t i2) {
+  // --- Mutex Lock, phased collisions own both dots already ---
+  // other threads may move or grow these dots, so nothing is read before
+  std::unique_lock<std::mutex> lock1, lock2;
+  if constexpr (Locked) {
+    std::lock(dots_mutexes[i1], dots_mutexes[i2]);
+    lock1 = std::unique_lock<std::mutex>(dots_mutexes[i1], std::adopt_lock);
+    lock2 = std::unique_lock<std::mutex>(dots_mutexes[i2], std::adopt_lock);
+    // either dot may have died on an earlier pair
+    if (!dots.isAlive(i1) || !dots.isAlive(i2))
+      return;
+  }
 
-  // --- Mutex Lock (no change here) ---
-  std::lock(dots_mutexes[i1], dots_mutexes[i2]);
-  std::lock_guard<std::mutex> lock1(dots_mutexes[i1], std::adopt_lock);
-  std::lock_guard<std::mutex> lock2(dots_mutexes[i2], std::adopt_lock);
+  ContactPair pair = {dots.positions_x[i1],  dots.positions_y[i1],
+                      dots.positions_x[i2],  dots.positions_y[i2],
+                      dots.velocities_x[i1], dots.velocities_y[i1],
+                      dots.velocities_x[i2], dots.velocities_y[i2]};
+  float minDist = dots.radii[i1] + dots.radii[i2];
+  if (!NarrowPhase::touching(pair, minDist))
+    return;
 
-  // Re-check not shown for brevity, but should be done in production code...
-
-  // --- 3. Collision Response using SIMD ---
-  __m128 dist_v = _mm_sqrt_ss(distSq_v);
-  float dist = _mm_cvtss_f32(dist_v);
-  __m128 normal =
-      _mm_div_ps(diff, _mm_shuffle_ps(dist_v, dist_v, 0)); // Broadcast dist
-
-  // Separate velocities for dot1 and dot2
-  __m128 vel1 = _mm_movelh_ps(vel, vel); // [v1y, v1x, v1y, v1x]
-  __m128 vel2 = _mm_movehl_ps(vel, vel); // [v2y, v2x, v2y, v2x]
-
-  // Reflection formula: v' = v - 2 * dot(v, n) * n
-  // We calculate this for both dots simultaneously where possible
-  __m128 dot1 = _mm_dp_ps(vel1, normal, 0x31);
-  __m128 dot2 = _mm_dp_ps(vel2, normal, 0x31);
-
-  __m128 two = _mm_set1_ps(2.0f);
-  __m128 reflection1 =
-      _mm_mul_ps(two, _mm_mul_ps(_mm_shuffle_ps(dot1, dot1, 0), normal));
-  __m128 reflection2 =
-      _mm_mul_ps(two, _mm_mul_ps(_mm_shuffle_ps(dot2, dot2, 0), normal));
-
-  // New velocities (original v1 is used for v2's reflection and vice versa,
-  // which is a common simplification)
-  __m128 new_vel1 = _mm_sub_ps(vel2, reflection2);
-  __m128 new_vel2 = _mm_sub_ps(vel1, reflection1);
-
-  // Renormalize velocities
-  __m128 len1_sq = _mm_dp_ps(new_vel1, new_vel1, 0x31);
-  __m128 len2_sq = _mm_dp_ps(new_vel2, new_vel2, 0x31);
-  __m128 inv_len1 = _mm_rsqrt_ss(len1_sq); // Reciprocal sqrt is faster
-  __m128 inv_len2 = _mm_rsqrt_ss(len2_sq);
-  new_vel1 = _mm_mul_ps(new_vel1, _mm_shuffle_ps(inv_len1, inv_len1, 0));
-  new_vel2 = _mm_mul_ps(new_vel2, _mm_shuffle_ps(inv_len2, inv_len2, 0));
-
-  // --- 4. Apply Separation and Store Results ---
-  float overlap = (minDist - dist) * 0.5f; // Simplified separation
-  __m128 overlap_v = _mm_set1_ps(overlap);
-  __m128 separation = _mm_mul_ps(normal, overlap_v);
-
-  __m128 new_pos1 = _mm_sub_ps(_mm_movelh_ps(pos, pos), separation);
-  __m128 new_pos2 = _mm_add_ps(_mm_movehl_ps(pos, pos), separation);
-
-  // Unpack results from SIMD registers and store back to memory
-  float results[4];
-  _mm_store_ps(results, new_pos1);
-  dots.positions_x[i1] = results[0];
-  dots.positions_y[i1] = results[1];
-  _mm_store_ps(results, new_pos2);
-  dots.positions_x[i2] = results[0];
-  dots.positions_y[i2] = results[1];
-
-  _mm_store_ps(results, new_vel1);
-  dots.velocities_x[i1] = results[0];
-  dots.velocities_y[i1] = results[1];
-  _mm_store_ps(results, new_vel2);
-  dots.velocities_x[i2] = results[0];
-  dots.velocities_y[i2] = results[1];
-
-  dots.radii[i1] = r1 + 1;
-  dots.radii[i2] = r2 + 1;
+  NarrowPhase::respond(pair, minDist);
+  dots.positions_x[i1] = pair.x1;
+  dots.positions_y[i1] = pair.y1;
+  dots.positions_x[i2] = pair.x2;
+  dots.positions_y[i2] = pair.y2;
+  dots.velocities_x[i1] = pair.vx1;
+  dots.velocities_y[i1] = pair.vy1;
+  dots.velocities_x[i2] = pair.vx2;
+  dots.velocities_y[i2] = pair.vy2;
+
+  dots.grow(i1);
+  dots.grow(i2);
 }
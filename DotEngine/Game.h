@@ -1,28 +1,88 @@
 #pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <memory>
 #include "AABB.h"
+#include "AlignedArray.h"
+#include "Broadphase.h"
+#include "CompactDots.h"
 #include "Dots.h"
+#include "MortonOrder.h"
 #include "SpatialGrid.h"
 #include "SimpleProfiler.h"
 
 
+struct DotBatch;
 class DotRenderer;
-class QuadTree;
 class ThreadPool;
 
 class Game
 {
 public:
-	Game(DotRenderer* aRenderer, ThreadPool* threadPool, Timer& timer);
+  static constexpr float DEFAULT_FIXED_STEP = 1.f / 60.f;
+  static constexpr int DEFAULT_MAX_SUBSTEPS = 4;
+  // dots that moved further than this in one step were respawned, they are
+  // not interpolated
+  static constexpr float SNAP_DISTANCE = 16.f;
+  // steps between morton sorts. Close to a fifth of the dots respawn every
+  // step at random spots, so the order only lasts a few steps
+  static constexpr int DEFAULT_REORDER_INTERVAL = 4;
+
+  enum class CollisionMode {
+    Locked, // column strips, every contact locks both dots
+    Phased, // grid blocks in 4 non-adjacent phases, no locks at all
+    Pairs,  // candidate pairs from the selected Broadphase, resolved in order
+  };
+
+  enum class DotLayout {
+    Float,   // float SoA, Dots::BYTES_PER_DOT
+    Compact, // quantized, CompactDots::BYTES_PER_DOT
+  };
+
+	Game(DotRenderer* aRenderer, ThreadPool* threadPool, Timer& timer,
+       size_t dotCount = Dots::DEFAULT_DOTS);
   ~Game();
   /*
    * The main update loop for the game. Runs through grid rebuild, updates on dots, collisions and rendering.
+   * The simulation advances in fixed steps (see setFixedStep), rendering
+   * interpolates between the last two steps.
    *
    * @param aDeltaTime Deltatime, very useful indeed
    */
 	void Update(float aDeltaTime);
 
+  /*
+   * Sets the simulation step. Frame time is collected in an accumulator and
+   * simulated in steps of exactly this length, at most maxSubsteps per
+   * frame. Time past the cap is dropped, so a slow frame slows the
+   * simulation down instead of making the next frame even slower.
+   *
+   * @param step Simulated seconds per step
+   * @param maxSubsteps Most steps per frame
+   */
+  void setFixedStep(float step, int maxSubsteps);
+
+  /*
+   * Pipelined frames. beginFrame hands the next simulation step to the
+   * simulation thread and returns right away, renderFrame rasterizes the
+   * snapshot of the previous step meanwhile, and endFrame waits for the step
+   * and makes its snapshot the one to render next. Call them in that order,
+   * from the thread that owns the renderer.
+   *
+   * @param aDeltaTime Deltatime of the step to simulate
+   */
+  void beginFrame(float aDeltaTime);
+  /*
+   * Rasterizes the last finished snapshot
+   *
+   * @param renderTimer Timer to put the render timings under, must not be
+   *                    touched by the simulation thread
+   */
+  void renderFrame(Timer &renderTimer);
+  void endFrame();
+
 
   /*
    * Reduction of wild animal population by selective slaughter. May also increases performance.
@@ -31,10 +91,23 @@ public:
   void cullDots(Timer& timer);
   /**
    * Processes collisions for all dots. Runs on the thread pool
-   *
-   * @param timer Timer for benchmarking
    */
-  void processCollisions_threaded(Timer& timer);
+  void processCollisions_threaded();
+  /**
+   * Processes collisions without locks. The grid is split into 2x2 cell
+   * blocks, and blocks are run in a 2x2 checkerboard of phases. A block
+   * touches its own cells and their half stencil (at most 4x3 cells), and
+   * blocks of the same phase are 4 cells apart, so no dot is touched by two
+   * threads.
+   */
+  void processCollisions_phased();
+  /**
+   * Collects the candidate pairs with the selected broadphase and resolves
+   * them one after another, in the order the broadphase wrote them. Slower
+   * than the phased cells, but every backend goes through the same
+   * response, so their costs can be compared directly.
+   */
+  void processCollisions_pairs(Timer &t_collision);
   /**
    * Performs collision checks and collision responses. Is thread safe.
    *
@@ -43,10 +116,162 @@ public:
    */
   void collideDots(size_t i1, size_t i2);
   void collideDotsSIMD(size_t i1, size_t i2);
+  /**
+   * Same as collideDotsSIMD but without locking, the caller has to make sure
+   * no other thread touches either dot.
+   */
+  void collideDotsUnlocked(size_t i1, size_t i2);
+
+  /*
+   * Changes the number of dots at runtime
+   *
+   * @param count The new number of dots
+   */
+  void resizeDots(size_t count);
+  size_t getDotCount() const { return dots.size(); }
+
+  /*
+   * Saves or restores the dots through a binary snapshot (see
+   * Dots::saveSnapshot). Only call these between frames.
+   *
+   * @param path The snapshot file
+   * @return false if the snapshot could not be written or read
+   */
+  bool saveDots(const std::string &path);
+  bool loadDots(const std::string &path);
+
+  void setCollisionMode(CollisionMode mode) { collisionMode = mode; }
+  CollisionMode getCollisionMode() const { return collisionMode; }
+  /// The mode that actually runs, the compact layout always runs phased
+  CollisionMode getEffectiveCollisionMode() const {
+    return dotLayout == DotLayout::Compact ? CollisionMode::Phased
+                                           : collisionMode;
+  }
+  /*
+   * Switches the layout the simulation runs on, the dots are converted
+   * right away. The compact layout always runs phased collisions. Only call
+   * between frames.
+   *
+   * @param layout The layout to simulate with
+   */
+  void setDotLayout(DotLayout layout);
+  DotLayout getDotLayout() const { return dotLayout; }
+  size_t getBytesPerDot() const {
+    return dotLayout == DotLayout::Compact ? CompactDots::BYTES_PER_DOT
+                                           : Dots::BYTES_PER_DOT;
+  }
+  /*
+   * Selects the broadphase used by CollisionMode::Pairs, the structure is
+   * rebuilt every step anyway so this can change at any frame.
+   *
+   * @param type The backend to use
+   */
+  void setBroadphase(Broadphase::Type type);
+  Broadphase::Type getBroadphase() const { return broadphase->type(); }
+  /// Candidate pairs of the last step in CollisionMode::Pairs
+  size_t getLastPairCount() const { return candidatePairs.size(); }
+  /*
+   * Margin of the pair cache, see CachedGridBroadphase::setMargin. Kept
+   * for when the cached broadphase gets selected.
+   *
+   * @param margin The margin in px
+   */
+  void setPairCacheMargin(float margin);
+  /// Stats of the last step, all zero unless the cached broadphase runs
+  PairCacheStats getPairCacheStats() const;
+  /*
+   * Sorts the dots along a Z-order curve every few steps, right after the
+   * culling, so the grid and the collisions walk memory mostly in order.
+   * The dots drift apart again as they move, how fast depends on the scene.
+   *
+   * @param steps Simulation steps between sorts, 0 never sorts
+   */
+  void setReorderInterval(int steps) { reorderInterval = std::max(0, steps); }
+  int getReorderInterval() const { return reorderInterval; }
+  /*
+   * Mean index distance of the dots sharing a grid cell (see
+   * SpatialGrid::getMeanIndexDistance), lower is better. Builds its own
+   * grid, so only call between frames.
+   */
+  double measureLocality();
+  /*
+   * Keeps the grid between steps and only moves the dots that changed
+   * cell, see SpatialGrid::update. Only call between frames.
+   *
+   * @param enabled Incremental updates instead of a rebuild every step
+   * @param churnThreshold Fraction of dots changing cell that still updates
+   *                       incrementally, past it the grid is rebuilt
+   */
+  void setIncrementalGrid(bool enabled,
+                          float churnThreshold =
+                              SpatialGrid::DEFAULT_CHURN_THRESHOLD) {
+    grid.setIncremental(enabled, churnThreshold);
+  }
+  bool isIncrementalGrid() const { return grid.isIncremental(); }
+  /// Fraction of the dots that changed cell in the last grid update
+  float getGridChurn() const { return grid.getLastChurn(); }
+  /// False if the last grid update was a full rebuild
+  bool wasGridIncremental() const { return grid.wasLastUpdateIncremental(); }
+  /// Also builds the grid serially every frame and compares the two
+  void setVerifyGrid(bool verify) { verifyGrid = verify; }
+
+private:
+  // render copy of the dots, written by the simulation, read by renderFrame
+  struct RenderSnapshot {
+    AlignedArray<float> positions_x;
+    AlignedArray<float> positions_y;
+    AlignedArray<uint8_t> radii;
+    std::vector<size_t> alive_indices;
+  };
+
+private:
+  /// Everything but the rendering: culling, grid, movement and collisions
+  void simulate(Timer &t_total, float aDeltaTime);
+  /// Runs the fixed steps that fit into the accumulator, returns how many
+  int advance(Timer &t_total, float aDeltaTime);
+  /// Morton sort of the dots in the current layout
+  void reorderDots(Timer &t_total);
+  /// Previous positions equal the current ones, nothing to interpolate
+  void resetInterpolation();
+  void renderSnapshot(const RenderSnapshot &snapshot, Timer &t_render);
+  void writeSnapshot(RenderSnapshot &snapshot) const;
+  /// Current positions as floats, whatever the layout
+  void copyPositions(float *out_x, float *out_y) const;
+  /// Brings the float dots up to date with the compact ones
+  void syncFloatDots();
+  void simulationLoop();
+  /// Screen fields, only from the thread that owns the renderer
+  void updateDebugFields();
+
+  template <bool Locked> void collideDotsImpl(size_t i1, size_t i2);
+  /**
+   * Collides a cell with itself and with its half stencil (right, and the
+   * three cells below). Every cell pair is visited exactly once, and the
+   * candidates are tested in SIMD batches before any response runs.
+   */
+  void collideCell(int gx, int gy);
+  void gatherCell(int gx, int gy, DotBatch &batch) const;
+  void resolveContacts(DotBatch &home, uint32_t slot, DotBatch &other,
+                       const uint32_t *hits, uint32_t hitCount);
+
 private:
+  static constexpr size_t PHASE_GRAIN = 4;    // grid blocks per chunk
+
   float timeSinceUpdate;
+  float fixedStep = DEFAULT_FIXED_STEP;
+  int maxSubsteps = DEFAULT_MAX_SUBSTEPS;
+  float accumulator = 0.f;
+  float interpolationAlpha = 1.f; // 0 is the previous step, 1 the last
+  AlignedArray<float> previous_x; // positions before the last step
+  AlignedArray<float> previous_y;
+  CollisionMode collisionMode = CollisionMode::Phased;
+  bool verifyGrid = false;
+  int reorderInterval = DEFAULT_REORDER_INTERVAL;
+  int stepsSinceReorder = 0;
+  DotLayout dotLayout = DotLayout::Float;
   /// Owner: Game
-  Dots dots;
+  Dots dots; // also holds the alive set and free-list in the compact layout
+  CompactDots compactDots; // only used in the compact layout
   std::vector<std::mutex> dots_mutexes;
 
 private:
@@ -54,4 +279,24 @@ private:
   Timer& timer;
   ThreadPool* threadPool;
   SpatialGrid grid;
+  SpatialGrid referenceGrid; // serial rebuild, verifyGrid and locality
+  MortonOrder mortonOrder;
+  std::unique_ptr<Broadphase> broadphase =
+      Broadphase::create(Broadphase::Type::Grid);
+  std::vector<CandidatePair> candidatePairs;
+  float pairCacheMargin = CachedGridBroadphase::DEFAULT_MARGIN;
+
+  // pipelining, the simulation thread is started by the first beginFrame
+  RenderSnapshot snapshots[2];
+  int frontSnapshot = 0; // rendered, the other one is simulated into
+  std::thread simThread;
+  std::mutex simMutex;
+  std::condition_variable simCondition;
+  float simDeltaTime = 0.f;
+  bool simRequested = false;
+  bool simBusy = false;
+  bool simQuit = false;
+
+  Timer *t_lastRender = nullptr;
+  int debugFrame = 0;
 };
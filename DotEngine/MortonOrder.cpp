@@ -0,0 +1,49 @@
+#include "MortonOrder.h"
+
+void MortonOrder::radixPass(int shift, ThreadPool *threadPool) {
+  const size_t count = order.size();
+  const size_t numChunks =
+      std::max<size_t>(1, (count + SORT_GRAIN - 1) / SORT_GRAIN);
+  swapKeys.resize(count);
+  swapOrder.resize(count);
+  chunkCounts.resize(numChunks * BUCKETS);
+
+  // pass 1: every chunk counts its digits into its own histogram
+  threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      uint32_t *counts = chunkCounts.data() + chunk * BUCKETS;
+      std::fill(counts, counts + BUCKETS, 0);
+      const size_t end = std::min(count, (chunk + 1) * SORT_GRAIN);
+      for (size_t k = chunk * SORT_GRAIN; k < end; k++)
+        counts[(keys[k] >> shift) & (BUCKETS - 1)]++;
+    }
+  });
+
+  // exclusive prefix sum, digit major so lower chunks come first inside a
+  // digit, which is what keeps the sort stable
+  uint32_t offset = 0;
+  for (uint32_t digit = 0; digit < BUCKETS; digit++) {
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+      uint32_t &bucket = chunkCounts[chunk * BUCKETS + digit];
+      const uint32_t bucketCount = bucket;
+      bucket = offset;
+      offset += bucketCount;
+    }
+  }
+
+  // pass 2: every chunk scatters into its own slots
+  threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      uint32_t *cursor = chunkCounts.data() + chunk * BUCKETS;
+      const size_t end = std::min(count, (chunk + 1) * SORT_GRAIN);
+      for (size_t k = chunk * SORT_GRAIN; k < end; k++) {
+        const uint32_t slot = cursor[(keys[k] >> shift) & (BUCKETS - 1)]++;
+        swapKeys[slot] = keys[k];
+        swapOrder[slot] = order[k];
+      }
+    }
+  });
+
+  keys.swap(swapKeys);
+  order.swap(swapOrder);
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "AlignedArray.h"
+#include "ScopeProfiler.h"
+#include "Settings.h"
+#include "ThreadPool.h"
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Z-order (Morton) sort of the dots. The screen is split into CELL_SIZE
+ * cells, the cell coordinates are bit interleaved into a 16 bit key, and a
+ * parallel LSD radix sort over the keys gives the new order of the dots.
+ * Dots that are close on screen end up close in memory, so the grid cells
+ * and the collision batches read a few cache lines instead of one per dot.
+ *
+ * sort() only works out the order, apply() then moves one array at a time
+ * into it. Every array of the dots has to go through apply(), otherwise the
+ * arrays no longer describe the same dots.
+ */
+class MortonOrder {
+public:
+  static constexpr int CELL_SIZE = 8;  // px per key cell
+  static constexpr int AXIS_BITS = 8;  // per axis, 256 cells
+  static constexpr int RADIX_BITS = 8; // two passes over the 16 bit keys
+  static constexpr uint32_t BUCKETS = 1u << RADIX_BITS;
+  static constexpr uint16_t DEAD_KEY = 0xFFFF; // dead dots go to the end
+  static constexpr size_t SORT_GRAIN = 16384;  // dots per sort chunk
+
+  static_assert(Settings::SCREEN_WIDTH / CELL_SIZE < (1 << AXIS_BITS) &&
+                    Settings::SCREEN_HEIGHT / CELL_SIZE < (1 << AXIS_BITS),
+                "the screen does not fit the morton keys");
+
+  /// Key of a position, positions outside the screen go to edge cells
+  static uint16_t key(float x, float y) {
+    constexpr int MAX_CELL = (1 << AXIS_BITS) - 2; // never hits DEAD_KEY
+    const uint32_t cx = std::clamp(static_cast<int>(x) / CELL_SIZE, 0, MAX_CELL);
+    const uint32_t cy = std::clamp(static_cast<int>(y) / CELL_SIZE, 0, MAX_CELL);
+    return static_cast<uint16_t>(spreadBits(cx) | (spreadBits(cy) << 1));
+  }
+
+  /*
+   * Sorts the dots [0, count) by their keys. The sort is stable, dots with
+   * the same key keep their order, so the result does not depend on the
+   * number of threads.
+   *
+   * @param count The number of dots
+   * @param keyOf Called as keyOf(dot index), returns the key of the dot
+   * @param threadPool The pool to split the chunks over
+   */
+  template <typename KeyOf>
+  void sort(size_t count, KeyOf keyOf, ThreadPool *threadPool) {
+    PROFILE_SCOPE("morton_sort");
+    keys.resize(count);
+    order.resize(count);
+    threadPool->parallel_for(0, count, SORT_GRAIN,
+                             [&](size_t begin, size_t end) {
+                               for (size_t i = begin; i < end; i++) {
+                                 keys[i] = keyOf(i);
+                                 order[i] = static_cast<uint32_t>(i);
+                               }
+                             });
+    for (int shift = 0; shift < 16; shift += RADIX_BITS)
+      radixPass(shift, threadPool);
+  }
+
+  /// New index -> old index, valid after sort()
+  const std::vector<uint32_t> &getOrder() const { return order; }
+
+  /*
+   * Moves the values of an array into the last sorted order
+   *
+   * @param array The array to reorder, with getOrder().size() values
+   * @param threadPool The pool to split the chunks over
+   */
+  template <typename T>
+  void apply(AlignedArray<T> &array, ThreadPool *threadPool) {
+    PROFILE_SCOPE("morton_apply");
+    const size_t count = order.size();
+    scratch.resize((count * sizeof(T) + sizeof(uint64_t) - 1) /
+                   sizeof(uint64_t));
+    T *sorted = reinterpret_cast<T *>(scratch.data());
+    T *values = array.data();
+
+    // gather into the scratch, then copy back, the gather reads anywhere
+    threadPool->parallel_for(0, count, SORT_GRAIN,
+                             [&](size_t begin, size_t end) {
+                               for (size_t i = begin; i < end; i++)
+                                 sorted[i] = values[order[i]];
+                             });
+    threadPool->parallel_for(0, count, SORT_GRAIN,
+                             [&](size_t begin, size_t end) {
+                               std::copy(sorted + begin, sorted + end,
+                                         values + begin);
+                             });
+  }
+
+private:
+  // 0b abcd -> 0b 0a0b0c0d
+  static uint32_t spreadBits(uint32_t v) {
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+  }
+
+  /// One stable counting sort pass over RADIX_BITS bits of the keys
+  void radixPass(int shift, ThreadPool *threadPool);
+
+  std::vector<uint16_t> keys;      // per slot, follows order
+  std::vector<uint32_t> order;     // new index -> old index
+  std::vector<uint16_t> swapKeys;  // radix pass output, scratch
+  std::vector<uint32_t> swapOrder;
+  std::vector<uint32_t> chunkCounts; // [chunk][bucket] histograms, scratch
+  AlignedArray<uint64_t> scratch;    // apply() gathers into this
+};
@@ -0,0 +1,206 @@
+#include "NarrowPhase.h"
+#include "Simd.h"
+
+// std
+#include <immintrin.h>
+
+// coincident dots have no usable normal, the response skips them too
+static constexpr float MIN_DIST_SQ = 0.01f;
+
+static uint32_t findContactsSSE4(float ax, float ay, float ar,
+                                 const float *bx, const float *by,
+                                 const float *br, uint32_t count,
+                                 uint32_t firstSlot, uint32_t *hits) {
+  uint32_t hitCount = 0;
+  uint32_t i = 0;
+
+  const __m128 v_ax = _mm_set1_ps(ax);
+  const __m128 v_ay = _mm_set1_ps(ay);
+  const __m128 v_ar = _mm_set1_ps(ar);
+  const __m128 v_min = _mm_set1_ps(MIN_DIST_SQ);
+
+  for (; i < count; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(bx + i), v_ax);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(by + i), v_ay);
+    __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    __m128 minDist = _mm_add_ps(v_ar, _mm_loadu_ps(br + i));
+    __m128 minDistSq = _mm_mul_ps(minDist, minDist);
+
+    __m128 inside = _mm_and_ps(_mm_cmplt_ps(distSq, minDistSq),
+                               _mm_cmpge_ps(distSq, v_min));
+    uint32_t bits = _mm_movemask_ps(inside);
+    if (count - i < 4)
+      bits &= (1u << (count - i)) - 1;
+
+    while (bits) {
+      hits[hitCount++] = firstSlot + i + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+  }
+
+  return hitCount;
+}
+
+SIMD_TARGET("avx2")
+static uint32_t findContactsAVX2(float ax, float ay, float ar,
+                                 const float *bx, const float *by,
+                                 const float *br, uint32_t count,
+                                 uint32_t firstSlot, uint32_t *hits) {
+  uint32_t hitCount = 0;
+  uint32_t i = 0;
+
+  const __m256 v_ax = _mm256_set1_ps(ax);
+  const __m256 v_ay = _mm256_set1_ps(ay);
+  const __m256 v_ar = _mm256_set1_ps(ar);
+  const __m256 v_min = _mm256_set1_ps(MIN_DIST_SQ);
+
+  for (; i < count; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(bx + i), v_ax);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(by + i), v_ay);
+    __m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    __m256 minDist = _mm256_add_ps(v_ar, _mm256_loadu_ps(br + i));
+    __m256 minDistSq = _mm256_mul_ps(minDist, minDist);
+
+    __m256 inside = _mm256_and_ps(_mm256_cmp_ps(distSq, minDistSq, _CMP_LT_OQ),
+                                  _mm256_cmp_ps(distSq, v_min, _CMP_GE_OQ));
+    uint32_t bits = _mm256_movemask_ps(inside);
+    if (count - i < 8)
+      bits &= (1u << (count - i)) - 1;
+
+    while (bits) {
+      hits[hitCount++] = firstSlot + i + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+  }
+
+  return hitCount;
+}
+
+SIMD_TARGET("avx512f")
+static uint32_t findContactsAVX512(float ax, float ay, float ar,
+                                   const float *bx, const float *by,
+                                   const float *br, uint32_t count,
+                                   uint32_t firstSlot, uint32_t *hits) {
+  uint32_t hitCount = 0;
+  uint32_t i = 0;
+
+  const __m512 v_ax = _mm512_set1_ps(ax);
+  const __m512 v_ay = _mm512_set1_ps(ay);
+  const __m512 v_ar = _mm512_set1_ps(ar);
+  const __m512 v_min = _mm512_set1_ps(MIN_DIST_SQ);
+
+  for (; i < count; i += 16) {
+    __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(bx + i), v_ax);
+    __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(by + i), v_ay);
+    // no fma, the contacts have to match the narrower kernels bit for bit
+    __m512 distSq = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+    __m512 minDist = _mm512_add_ps(v_ar, _mm512_loadu_ps(br + i));
+    __m512 minDistSq = _mm512_mul_ps(minDist, minDist);
+
+    // masked compare, closer than both radii but not on top of each other
+    __mmask16 mask = _mm512_cmp_ps_mask(distSq, minDistSq, _CMP_LT_OQ) &
+                     _mm512_cmp_ps_mask(distSq, v_min, _CMP_GE_OQ);
+    if (count - i < 16)
+      mask &= (1u << (count - i)) - 1;
+
+    uint32_t bits = mask;
+    while (bits) {
+      hits[hitCount++] = firstSlot + i + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+  }
+
+  return hitCount;
+}
+
+uint32_t NarrowPhase::findContacts(float ax, float ay, float ar,
+                                   const float *bx, const float *by,
+                                   const float *br, uint32_t count,
+                                   uint32_t firstSlot, uint32_t *hits) {
+  switch (Simd::active()) {
+  case Simd::Level::AVX512:
+    return findContactsAVX512(ax, ay, ar, bx, by, br, count, firstSlot, hits);
+  case Simd::Level::AVX2:
+    return findContactsAVX2(ax, ay, ar, bx, by, br, count, firstSlot, hits);
+  default:
+    return findContactsSSE4(ax, ay, ar, bx, by, br, count, firstSlot, hits);
+  }
+}
+
+bool NarrowPhase::touching(const ContactPair &pair, float minDist) {
+  // Layout: [y2, x2, y1, x1]
+  __m128 pos = _mm_set_ps(pair.y2, pair.x2, pair.y1, pair.x1);
+  // Subtract the lower half [y1, x1] from the upper half [y2, x2]
+  __m128 diff = _mm_sub_ps(_mm_movehl_ps(pos, pos), pos);
+  // 0x31: multiply lanes 0 and 1, sum them into lane 0
+  float distSq = _mm_cvtss_f32(_mm_dp_ps(diff, diff, 0x31));
+  return distSq < minDist * minDist && distSq >= MIN_DIST_SQ;
+}
+
+void NarrowPhase::respond(ContactPair &pair, float minDist) {
+  // --- 1. Load Data into SIMD Registers ---
+  // Layout: [y2, x2, y1, x1]
+  __m128 pos = _mm_set_ps(pair.y2, pair.x2, pair.y1, pair.x1);
+  __m128 vel = _mm_set_ps(pair.vy2, pair.vx2, pair.vy1, pair.vx1);
+
+  __m128 diff = _mm_sub_ps(_mm_movehl_ps(pos, pos), pos);
+  __m128 distSq_v = _mm_dp_ps(diff, diff, 0x31);
+
+  // --- 2. Collision Response using SIMD ---
+  __m128 dist_v = _mm_sqrt_ss(distSq_v);
+  float dist = _mm_cvtss_f32(dist_v);
+  __m128 normal =
+      _mm_div_ps(diff, _mm_shuffle_ps(dist_v, dist_v, 0)); // Broadcast dist
+
+  // Separate velocities for dot1 and dot2
+  __m128 vel1 = _mm_movelh_ps(vel, vel); // [v1y, v1x, v1y, v1x]
+  __m128 vel2 = _mm_movehl_ps(vel, vel); // [v2y, v2x, v2y, v2x]
+
+  // Reflection formula: v' = v - 2 * dot(v, n) * n
+  // We calculate this for both dots simultaneously where possible
+  __m128 dot1 = _mm_dp_ps(vel1, normal, 0x31);
+  __m128 dot2 = _mm_dp_ps(vel2, normal, 0x31);
+
+  __m128 two = _mm_set1_ps(2.0f);
+  __m128 reflection1 =
+      _mm_mul_ps(two, _mm_mul_ps(_mm_shuffle_ps(dot1, dot1, 0), normal));
+  __m128 reflection2 =
+      _mm_mul_ps(two, _mm_mul_ps(_mm_shuffle_ps(dot2, dot2, 0), normal));
+
+  // New velocities (original v1 is used for v2's reflection and vice versa,
+  // which is a common simplification)
+  __m128 new_vel1 = _mm_sub_ps(vel2, reflection2);
+  __m128 new_vel2 = _mm_sub_ps(vel1, reflection1);
+
+  // Renormalize velocities
+  __m128 len1_sq = _mm_dp_ps(new_vel1, new_vel1, 0x31);
+  __m128 len2_sq = _mm_dp_ps(new_vel2, new_vel2, 0x31);
+  __m128 inv_len1 = _mm_rsqrt_ss(len1_sq); // Reciprocal sqrt is faster
+  __m128 inv_len2 = _mm_rsqrt_ss(len2_sq);
+  new_vel1 = _mm_mul_ps(new_vel1, _mm_shuffle_ps(inv_len1, inv_len1, 0));
+  new_vel2 = _mm_mul_ps(new_vel2, _mm_shuffle_ps(inv_len2, inv_len2, 0));
+
+  // --- 3. Apply Separation and Store Results ---
+  float overlap = (minDist - dist) * 0.5f; // Simplified separation
+  __m128 overlap_v = _mm_set1_ps(overlap);
+  __m128 separation = _mm_mul_ps(normal, overlap_v);
+
+  __m128 new_pos1 = _mm_sub_ps(_mm_movelh_ps(pos, pos), separation);
+  __m128 new_pos2 = _mm_add_ps(_mm_movehl_ps(pos, pos), separation);
+
+  // Unpack results from SIMD registers
+  alignas(16) float results[4];
+  _mm_store_ps(results, new_pos1);
+  pair.x1 = results[0];
+  pair.y1 = results[1];
+  _mm_store_ps(results, new_pos2);
+  pair.x2 = results[0];
+  pair.y2 = results[1];
+
+  _mm_store_ps(results, new_vel1);
+  pair.vx1 = results[0];
+  pair.vy1 = results[1];
+  _mm_store_ps(results, new_vel2);
+  pair.vx2 = results[0];
+  pair.vy2 = results[1];
+}
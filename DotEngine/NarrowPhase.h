@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * SoA copy of a handful of dots (usually one grid cell), padded with
+ * sentinels so SIMD loads can always read a full vector past the end.
+ */
+struct DotBatch {
+  static constexpr uint32_t PADDING = 16; // widest vector, AVX-512 floats
+  static constexpr float SENTINEL = -1.0e9f; // far away, never collides
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> r;
+  std::vector<uint32_t> index; // dot index of every slot
+  uint32_t count = 0;
+
+  void clear() { count = 0; }
+
+  void push(uint32_t dotIndex, float px, float py, float radius) {
+    if (x.size() < count + PADDING + 1) {
+      size_t capacity = (count + PADDING + 1) * 2;
+      x.resize(capacity);
+      y.resize(capacity);
+      r.resize(capacity);
+      index.resize(capacity);
+    }
+    x[count] = px;
+    y[count] = py;
+    r[count] = radius;
+    index[count] = dotIndex;
+    count++;
+  }
+
+  /// Writes the sentinels behind the last dot, call after the last push
+  void pad() {
+    if (x.size() < count + PADDING) {
+      x.resize(count + PADDING);
+      y.resize(count + PADDING);
+      r.resize(count + PADDING);
+      index.resize(count + PADDING);
+    }
+    for (uint32_t i = count; i < count + PADDING; ++i) {
+      x[i] = SENTINEL;
+      y[i] = SENTINEL;
+      r[i] = 0.f;
+    }
+  }
+
+  /// Updates a slot after its dot was moved, dead dots become sentinels
+  void set(uint32_t slot, float px, float py, float radius, bool alive) {
+    x[slot] = alive ? px : SENTINEL;
+    y[slot] = alive ? py : SENTINEL;
+    r[slot] = radius;
+  }
+};
+
+// positions and velocities of two dots, read and written by respond
+struct ContactPair {
+  float x1, y1, x2, y2;
+  float vx1, vy1, vx2, vy2;
+};
+
+namespace NarrowPhase {
+/*
+ * Tests one dot against a run of batch slots, 16 (AVX-512), 8 (AVX2) or 4
+ * (SSE) at a time depending on Simd::active(), and writes the slots that
+ * overlap it. Most candidates miss, so only the hits have to go through the
+ * actual collision response.
+ *
+ * @param ax, ay, ar Position and radius of the dot
+ * @param bx, by, br Start of the batch slots to test against, has to be
+ *                   readable for a full vector past count (see DotBatch)
+ * @param count Number of slots to test
+ * @param firstSlot Added to every written slot
+ * @param hits Output, needs room for count slots
+ * @return Number of hits written
+ */
+uint32_t findContacts(float ax, float ay, float ar, const float *bx,
+                      const float *by, const float *br, uint32_t count,
+                      uint32_t firstSlot, uint32_t *hits);
+
+/// True if the dots overlap and are far enough apart to have a normal
+bool touching(const ContactPair &pair, float minDist);
+
+/*
+ * Collision response of two touching dots, in SSE. Both velocities are
+ * reflected along the contact normal and normalized again, and the dots are
+ * pushed apart. The same for every dot layout, so they all bounce alike.
+ *
+ * @param pair The two dots, updated in place
+ * @param minDist Sum of both radii
+ */
+void respond(ContactPair &pair, float minDist);
+} // namespace NarrowPhase
@@ -0,0 +1,246 @@
+#include "ScopeProfiler.h"
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+std::atomic<bool> ScopeProfiler::s_enabled = false;
+
+namespace {
+// single producer (the owning thread), single consumer (Collect)
+struct ThreadRing {
+  ScopeProfiler::Event events[ScopeProfiler::RING_CAPACITY];
+  std::atomic<uint64_t> head = 0; // next write, only the owner moves it
+  std::atomic<uint64_t> tail = 0; // next read, only Collect moves it
+  std::atomic<uint64_t> dropped = 0;
+  uint32_t thread = 0;  // track in the trace
+  std::string name;     // registry mutex
+};
+
+struct TraceEvent {
+  ScopeProfiler::Event event;
+  uint32_t thread;
+};
+
+// everything below is only touched with the registry mutex held, except the
+// rings themselves
+std::mutex s_registryMutex;
+std::vector<std::string> s_scopeNames;
+std::vector<std::unique_ptr<ThreadRing>> s_rings; // never freed, see s_threadRing
+std::vector<ScopeProfiler::ScopeStats> s_stats;
+bool s_tracing = false;
+std::vector<TraceEvent> s_trace;
+uint64_t s_droppedTraceEvents = 0;
+
+// rings outlive their threads, so a pointer to one is always valid
+thread_local ThreadRing *s_threadRing = nullptr;
+
+ThreadRing &threadRing() {
+  if (s_threadRing == nullptr) {
+    std::lock_guard<std::mutex> lock(s_registryMutex);
+    s_rings.push_back(std::make_unique<ThreadRing>());
+    s_threadRing = s_rings.back().get();
+    s_threadRing->thread = static_cast<uint32_t>(s_rings.size() - 1);
+    s_threadRing->name = "thread " + std::to_string(s_threadRing->thread);
+  }
+  return *s_threadRing;
+}
+} // namespace
+
+uint16_t ScopeProfiler::RegisterScope(const char *name) {
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  for (size_t i = 0; i < s_scopeNames.size(); ++i) {
+    if (s_scopeNames[i] == name)
+      return static_cast<uint16_t>(i);
+  }
+  // out of ids, the rest shares the last one
+  if (s_scopeNames.size() == MAX_SCOPES)
+    return MAX_SCOPES - 1;
+
+  s_scopeNames.emplace_back(name);
+  s_stats.emplace_back();
+  s_stats.back().name = name;
+  return static_cast<uint16_t>(s_scopeNames.size() - 1);
+}
+
+void ScopeProfiler::SetTracing(bool tracing) {
+  {
+    std::lock_guard<std::mutex> lock(s_registryMutex);
+    s_tracing = tracing;
+  }
+  if (tracing)
+    SetEnabled(true);
+}
+
+bool ScopeProfiler::IsTracing() {
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  return s_tracing;
+}
+
+void ScopeProfiler::SetThreadName(const std::string &name) {
+  ThreadRing &ring = threadRing();
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  ring.name = name;
+}
+
+void ScopeProfiler::Record(uint16_t scope, uint64_t begin, uint64_t end) {
+  ThreadRing &ring = threadRing();
+  const uint64_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ring.events[head % RING_CAPACITY] = {begin, end, scope};
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void ScopeProfiler::Collect() {
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  for (auto &ring : s_rings) {
+    const uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail) {
+      const Event &event = ring->events[tail % RING_CAPACITY];
+      ScopeStats &stats = s_stats[event.scope];
+      const uint64_t ticks = event.end - event.begin;
+      stats.minTicks = stats.calls == 0 ? ticks : std::min(stats.minTicks, ticks);
+      stats.maxTicks = std::max(stats.maxTicks, ticks);
+      stats.totalTicks += ticks;
+      stats.calls++;
+
+      if (!s_tracing)
+        continue;
+      if (s_trace.size() < MAX_TRACE_EVENTS)
+        s_trace.push_back({event, ring->thread});
+      else
+        s_droppedTraceEvents++;
+    }
+    ring->tail.store(head, std::memory_order_release);
+  }
+}
+
+void ScopeProfiler::Reset() {
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  for (auto &ring : s_rings) {
+    ring->tail.store(ring->head.load(std::memory_order_acquire),
+                     std::memory_order_release);
+    ring->dropped.store(0, std::memory_order_relaxed);
+  }
+  for (ScopeStats &stats : s_stats) {
+    stats = ScopeStats{stats.name};
+  }
+  s_trace.clear();
+  s_droppedTraceEvents = 0;
+}
+
+bool ScopeProfiler::WriteChromeTrace(const std::string &path) {
+  const double ticksPerUs = TicksPerMs() / 1000.0;
+
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  std::ofstream file(path);
+  if (!file.is_open())
+    return false;
+
+  uint64_t start = UINT64_MAX;
+  for (const TraceEvent &trace : s_trace)
+    start = std::min(start, trace.event.begin);
+
+  file << std::fixed << std::setprecision(3) << "{\"traceEvents\": [\n";
+  // thread names first, they label the tracks
+  bool first = true;
+  for (const auto &ring : s_rings) {
+    file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", "
+         << "\"pid\": 1, \"tid\": " << ring->thread
+         << ", \"args\": {\"name\": \"" << ring->name << "\"}}";
+    first = false;
+  }
+  // complete events, ts and dur are in microseconds
+  for (const TraceEvent &trace : s_trace) {
+    file << (first ? "" : ",\n") << "{\"name\": \""
+         << s_scopeNames[trace.event.scope] << "\", \"ph\": \"X\", \"ts\": "
+         << (trace.event.begin - start) / ticksPerUs
+         << ", \"dur\": " << (trace.event.end - trace.event.begin) / ticksPerUs
+         << ", \"pid\": 1, \"tid\": " << trace.thread << "}";
+    first = false;
+  }
+  file << "\n],\n\"displayTimeUnit\": \"ms\",\n"
+       << "\"otherData\": {\"dropped_events\": " << s_droppedTraceEvents
+       << "}}\n";
+  return file.good();
+}
+
+double ScopeProfiler::TicksPerMs() {
+  // measured once against the steady clock, the TSC is invariant on
+  // anything we run on
+  static const double ticksPerMs = [] {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startTicks = Now();
+    while (std::chrono::steady_clock::now() - start <
+           std::chrono::milliseconds(10)) {
+    }
+    uint64_t ticks = Now() - startTicks;
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    return ticks / ms;
+  }();
+  return ticksPerMs;
+}
+
+uint64_t ScopeProfiler::DroppedEvents() {
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  uint64_t dropped = 0;
+  for (auto &ring : s_rings)
+    dropped += ring->dropped.load(std::memory_order_relaxed);
+  return dropped;
+}
+
+std::vector<ScopeProfiler::ScopeStats> ScopeProfiler::GetStats() {
+  std::vector<ScopeStats> stats;
+  {
+    std::lock_guard<std::mutex> lock(s_registryMutex);
+    for (const ScopeStats &scope : s_stats) {
+      if (scope.calls > 0)
+        stats.push_back(scope);
+    }
+  }
+  std::sort(stats.begin(), stats.end(),
+            [](const auto &a, const auto &b) { return a.name < b.name; });
+  return stats;
+}
+
+std::string ScopeProfiler::GetStatsCSV() {
+  const double ticksPerMs = TicksPerMs();
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(4);
+  for (const ScopeStats &scope : GetStats()) {
+    ss << "scopes/" << scope.name << ",1,"
+       << scope.totalTicks / ticksPerMs / scope.calls << ","
+       << scope.minTicks / ticksPerMs << "," << scope.maxTicks / ticksPerMs
+       << "," << scope.totalTicks / ticksPerMs << "," << scope.calls << "\n";
+  }
+  return ss.str();
+}
+
+std::string ScopeProfiler::GetStatsJSON() {
+  const double ticksPerMs = TicksPerMs();
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(4) << "[";
+  auto stats = GetStats();
+  for (size_t i = 0; i < stats.size(); ++i) {
+    const ScopeStats &scope = stats[i];
+    ss << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << scope.name
+       << "\", \"avg_ms\": " << scope.totalTicks / ticksPerMs / scope.calls
+       << ", \"min_ms\": " << scope.minTicks / ticksPerMs
+       << ", \"max_ms\": " << scope.maxTicks / ticksPerMs
+       << ", \"total_ms\": " << scope.totalTicks / ticksPerMs
+       << ", \"calls\": " << scope.calls << "}";
+  }
+  ss << "\n  ]";
+  return ss.str();
+}
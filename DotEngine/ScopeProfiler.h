@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// __rdtsc
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+// build with -DDOTS_SCOPE_PROFILER=0 to compile every PROFILE_SCOPE out
+#ifndef DOTS_SCOPE_PROFILER
+#define DOTS_SCOPE_PROFILER 1
+#endif
+
+/*
+ * Low overhead profiler for hot loops and thread pool jobs. Scopes are
+ * registered once by name and then only referenced by a small id, begin and
+ * end are read from the TSC, and every thread writes its finished scopes into
+ * its own lock-free ring buffer. Collect drains all rings into per scope
+ * stats, call it once per frame from the main thread. With tracing on, Collect
+ * also keeps the raw events, which can be written as a Chrome trace with one
+ * track per thread.
+ *
+ * Recording is off until SetEnabled(true), a disabled scope costs one
+ * relaxed load.
+ */
+class ScopeProfiler {
+public:
+  static constexpr uint32_t RING_CAPACITY = 1 << 16; // events per thread
+  static constexpr uint16_t MAX_SCOPES = 256;
+  static constexpr size_t MAX_TRACE_EVENTS = 1 << 22; // about 128 MB
+
+  struct Event {
+    uint64_t begin;
+    uint64_t end;
+    uint16_t scope;
+  };
+
+  struct ScopeStats {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t totalTicks = 0;
+    uint64_t minTicks = 0;
+    uint64_t maxTicks = 0;
+  };
+
+  /*
+   * Registers a scope name, registering the same name twice returns the same
+   * id. Takes a lock, so do it once (PROFILE_SCOPE keeps the id in a static).
+   *
+   * @param name Name shown in the reports
+   * @return Id to record the scope with
+   */
+  static uint16_t RegisterScope(const char *name);
+
+  static void SetEnabled(bool enabled) {
+    s_enabled.store(enabled, std::memory_order_relaxed);
+  }
+  static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+  /// Keeps every collected event for WriteChromeTrace, also enables recording
+  static void SetTracing(bool tracing);
+  static bool IsTracing();
+  /// Names the track of the calling thread in the trace
+  static void SetThreadName(const std::string &name);
+
+  static uint64_t Now() { return __rdtsc(); }
+
+  /// Pushes a finished scope into the ring of the calling thread
+  static void Record(uint16_t scope, uint64_t begin, uint64_t end);
+
+  /// Drains the rings of every thread into the scope stats
+  static void Collect();
+  /// Clears the stats and the trace, drops whatever is still in the rings
+  static void Reset();
+
+  /*
+   * Writes the traced events as Chrome Trace Event JSON, open it in
+   * chrome://tracing or ui.perfetto.dev. Every thread gets its own track,
+   * and nested scopes show up stacked.
+   *
+   * @param path The file to write
+   * @return false if the file could not be written
+   */
+  static bool WriteChromeTrace(const std::string &path);
+
+  static double TicksPerMs();
+  /// Events lost because a ring was full, Collect more often if this grows
+  static uint64_t DroppedEvents();
+
+  /// Stats of every scope that was hit, sorted by name
+  static std::vector<ScopeStats> GetStats();
+  /// Same columns as SimpleProfiler::getTimersCSV, paths are scopes/<name>
+  static std::string GetStatsCSV();
+  static std::string GetStatsJSON();
+
+private:
+  static std::atomic<bool> s_enabled;
+};
+
+// times the rest of the enclosing block
+class ProfileScope {
+public:
+  explicit ProfileScope(uint16_t scope)
+      : m_scope(scope), m_active(ScopeProfiler::IsEnabled()),
+        m_begin(m_active ? ScopeProfiler::Now() : 0) {}
+  ~ProfileScope() {
+    if (m_active)
+      ScopeProfiler::Record(m_scope, m_begin, ScopeProfiler::Now());
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  uint16_t m_scope;
+  bool m_active;
+  uint64_t m_begin;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if DOTS_SCOPE_PROFILER
+// the id is registered the first time the line runs, after that it is free
+#define PROFILE_SCOPE(name)                                                    \
+  static const uint16_t PROFILE_CONCAT(s_profileScopeId, __LINE__) =          \
+      ScopeProfiler::RegisterScope(name);                                      \
+  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(                         \
+      PROFILE_CONCAT(s_profileScopeId, __LINE__))
+#else
+#define PROFILE_SCOPE(name)
+#endif
@@ -0,0 +1,71 @@
+#include "Simd.h"
+
+#ifdef _MSC_VER
+#include <immintrin.h>
+#include <intrin.h>
+
+static bool cpuHasAll(int leaf7Ebx, unsigned long long xcr0) {
+  int info[4];
+  __cpuid(info, 1);
+  // the OS has to save the wide registers too, not just the cpu have them
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & xcr0) != xcr0)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & leaf7Ebx) == leaf7Ebx;
+}
+#endif
+
+Simd::Level Simd::detected() {
+  static const Level best = [] {
+#ifdef _MSC_VER
+    constexpr int AVX2_BIT = 1 << 5;
+    constexpr int AVX512F_BIT = 1 << 16;
+    constexpr int AVX512BW_BIT = 1 << 30;
+    if (cpuHasAll(AVX512F_BIT | AVX512BW_BIT, 0xE6))
+      return Level::AVX512;
+    if (cpuHasAll(AVX2_BIT, 0x6))
+      return Level::AVX2;
+#else
+    // also checks that the OS saves the wide registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw"))
+      return Level::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+      return Level::AVX2;
+#endif
+    return Level::SSE4;
+  }();
+  return best;
+}
+
+std::atomic<Simd::Level> Simd::activeLevel{Simd::detected()};
+
+Simd::Level Simd::setLevel(Level requested) {
+  const Level clamped = requested > detected() ? detected() : requested;
+  activeLevel.store(clamped, std::memory_order_relaxed);
+  return clamped;
+}
+
+const char *Simd::name(Level level) {
+  switch (level) {
+  case Level::SSE4:
+    return "sse4";
+  case Level::AVX2:
+    return "avx2";
+  case Level::AVX512:
+    return "avx512";
+  }
+  return "unknown";
+}
+
+bool Simd::parse(const std::string &name, Level &level) {
+  for (Level candidate : {Level::SSE4, Level::AVX2, Level::AVX512}) {
+    if (name == Simd::name(candidate)) {
+      level = candidate;
+      return true;
+    }
+  }
+  return false;
+}
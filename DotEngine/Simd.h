@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+// lets one function use a wider instruction set than the rest of the build,
+// only call it after Simd::active() said the cpu has it
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa) // MSVC emits any intrinsic without flags
+#endif
+
+/*
+ * Picks the widest SIMD kernels the cpu can run, at startup. The build
+ * itself only assumes SSE4.2, so one binary runs on any machine from the
+ * last decade and still gets AVX2 or AVX-512 where they exist.
+ *
+ * The kernels (blending, dot updates, contact tests) switch on active()
+ * every call. setLevel() forces a lower level, to A/B them on one machine.
+ */
+class Simd {
+public:
+  enum class Level {
+    SSE4,   // 4 lanes, the build baseline
+    AVX2,   // 8 lanes
+    AVX512, // 16 lanes, AVX-512F and BW
+  };
+
+  /// Best level of this cpu and OS, worked out once
+  static Level detected();
+  /// Level the kernels run at
+  static Level active() { return activeLevel.load(std::memory_order_relaxed); }
+  /*
+   * Overrides the level, only call between frames. Levels the cpu does not
+   * have are clamped down to detected(), they would crash.
+   *
+   * @param requested The level to run at
+   * @return The level that is active now
+   */
+  static Level setLevel(Level requested);
+
+  static const char *name(Level level);
+  /// "sse4", "avx2" or "avx512", false if the name is unknown
+  static bool parse(const std::string &name, Level &level);
+
+private:
+  static std::atomic<Level> activeLevel;
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <fstream> // Required for file output
@@ -7,6 +8,7 @@
 #include <string> // Required for std::string
 #include <unordered_map>
 #include <iostream>
+#include <vector>
 
 struct Timer {
   static constexpr int MAX_LEVELS = 5;
@@ -16,6 +18,8 @@ private:
 
 public:
   float accumulated = 0;
+  float minimum = 0;
+  float maximum = 0;
   int count = 0;
 
   int level = 0;
@@ -28,6 +32,8 @@ public:
                         std::chrono::high_resolution_clock::now() - start)
                         .count();
     accumulated += duration;
+    minimum = count == 0 ? duration : std::min(minimum, duration);
+    maximum = std::max(maximum, duration);
     count++;
   }
 
@@ -59,6 +65,16 @@ public:
     }
     return ss.str();
   }
+
+  /// Children sorted by name, so reports are stable between runs
+  std::vector<std::pair<std::string, const Timer *>> sortedChildren() const {
+    std::vector<std::pair<std::string, const Timer *>> children;
+    for (const auto &[childName, childTimer] : name_childTimer)
+      children.push_back({childName, &childTimer});
+    std::sort(children.begin(), children.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    return children;
+  }
 };
 
 class SimpleProfiler {
@@ -107,7 +123,79 @@ private:
     }
   }
 
+  void csvTimerRecursive(std::stringstream &ss, const std::string &path,
+                         const Timer &timer, int level) const {
+    float avg = timer.count > 0 ? timer.accumulated / timer.count : 0.f;
+    ss << path << "," << level << "," << std::fixed << std::setprecision(4)
+       << avg << "," << timer.minimum << "," << timer.maximum << ","
+       << timer.accumulated << "," << timer.count << "\n";
+
+    for (const auto &[childName, childTimer] : timer.sortedChildren()) {
+      csvTimerRecursive(ss, path + "/" + childName, *childTimer, level + 1);
+    }
+  }
+
+  void jsonTimerRecursive(std::stringstream &ss, const std::string &name,
+                          const Timer &timer, int level) const {
+    std::string indent(level * 2 + 2, ' ');
+    float avg = timer.count > 0 ? timer.accumulated / timer.count : 0.f;
+    ss << indent << "{\"name\": \"" << name << "\", " << std::fixed
+       << std::setprecision(4) << "\"avg_ms\": " << avg
+       << ", \"min_ms\": " << timer.minimum
+       << ", \"max_ms\": " << timer.maximum
+       << ", \"total_ms\": " << timer.accumulated
+       << ", \"calls\": " << timer.count << ", \"children\": [";
+
+    auto children = timer.sortedChildren();
+    for (size_t i = 0; i < children.size(); ++i) {
+      ss << (i == 0 ? "\n" : ",\n");
+      jsonTimerRecursive(ss, children[i].first, *children[i].second,
+                         level + 1);
+    }
+    if (!children.empty())
+      ss << "\n" << indent;
+    ss << "]}";
+  }
+
+  std::vector<std::pair<std::string, const Timer *>> sortedRoots() const {
+    std::vector<std::pair<std::string, const Timer *>> roots;
+    for (const auto &[rootName, rootTimer] : name_timer)
+      roots.push_back({rootName, &rootTimer});
+    std::sort(roots.begin(), roots.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    return roots;
+  }
+
 public:
+  /**
+   * @brief Builds the whole timer tree as CSV, one row per timer.
+   * Columns: path,level,avg_ms,min_ms,max_ms,total_ms,calls
+   */
+  std::string getTimersCSV() const {
+    std::stringstream ss;
+    ss << "path,level,avg_ms,min_ms,max_ms,total_ms,calls\n";
+    for (const auto &[rootName, rootTimer] : sortedRoots()) {
+      csvTimerRecursive(ss, rootName, *rootTimer, 0);
+    }
+    return ss.str();
+  }
+
+  /**
+   * @brief Builds the whole timer tree as a JSON array of nested timer
+   * objects (name, avg_ms, min_ms, max_ms, total_ms, calls, children).
+   */
+  std::string getTimersJSON() const {
+    std::stringstream ss;
+    ss << "[";
+    auto roots = sortedRoots();
+    for (size_t i = 0; i < roots.size(); ++i) {
+      ss << (i == 0 ? "\n" : ",\n");
+      jsonTimerRecursive(ss, roots[i].first, *roots[i].second, 0);
+    }
+    ss << "\n]";
+    return ss.str();
+  }
+
   /**
    * @brief Prints the full timer report to the console and optionally saves it
    * to a file.
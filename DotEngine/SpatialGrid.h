@@ -1,72 +1,475 @@
 #pragma once
+#include "CompactDots.h"
 #include "Dots.h"
+#include "ScopeProfiler.h"
 #include "Settings.h"
+#include "ThreadPool.h"
 
 // std
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
+/*
+ * Uniform grid over the screen, rebuilt every frame with a counting sort.
+ * All dot indices live in one flat array sorted by cell, and cellStart holds
+ * where every cell begins (CSR layout). There is no per cell capacity, so
+ * clustered cells never drop dots.
+ *
+ * In incremental mode (setIncremental) every cell gets some slack behind its
+ * dots, and update() only moves the dots whose cell changed since the last
+ * step. When too many dots changed cell, or a cell runs out of slack, it
+ * falls back to the full rebuild. A small sample of dots estimates the churn
+ * first, so busy steps go straight to a plain rebuild without the slack.
+ */
 class SpatialGrid {
 public:
   static constexpr int GRID_WIDTH = 80;
   static constexpr int GRID_HEIGHT = 45;
-  static constexpr int CELL_CAPACITY = 64;
-private:
-
+  static constexpr int CELL_COUNT = GRID_WIDTH * GRID_HEIGHT;
+  static constexpr size_t MIN_DOTS_PER_CHUNK = 4096; // parallel rebuild
+  static constexpr size_t UPDATE_GRAIN = 16384;      // dots per update chunk
+  static constexpr uint32_t MIN_SLACK = 16; // free slots per cell, incremental
+  // fraction of dots that may change cell before update() rebuilds instead.
+  // A move costs a handful of cache misses, past ~8% the rebuild is faster
+  static constexpr float DEFAULT_CHURN_THRESHOLD = 0.08f;
+  static constexpr size_t CHURN_SAMPLES = 1024; // dots that estimate churn
 
+private:
   const float cell_width;
   const float cell_height;
-public:
-  struct Cell {
-    size_t indices[CELL_CAPACITY];
-    int count = 0;
+
+  std::vector<uint32_t> cellStart;   // CELL_COUNT + 1 offsets into indices
+  std::vector<uint32_t> cellCount;   // dots per cell, the rest is slack
+  std::vector<uint32_t> cellIndices; // dot indices, sorted by cell
+  std::vector<uint32_t> cellCursor;  // scatter write positions, scratch
+  std::vector<uint32_t> dotKeys;     // cell key per alive dot, scratch
+  std::vector<uint32_t> chunkCounts; // [chunk][cell] histograms, scratch
+  size_t gridDots = 0;
+
+  // incremental mode, per dot index where the dot sits in the grid
+  struct Move {
+    uint32_t dot;
+    uint32_t cell; // the new one
   };
-  Cell Grid[GRID_WIDTH][GRID_HEIGHT];
+  bool incremental = false;
+  bool tracked = false;      // dotCell and dotSlot describe the grid
+  bool rebuildOrder = true;  // cells hold the dots in alive_indices order
+  float churnThreshold = DEFAULT_CHURN_THRESHOLD;
+  float lastChurn = 0.f;
+  bool lastUpdateIncremental = false;
+  std::vector<uint32_t> dotCell;
+  std::vector<uint32_t> dotSlot;
+  std::vector<uint32_t> newCell; // per dot, pass 1 of update, scratch
+  std::vector<std::vector<Move>> chunkMoves; // dots that changed cell
+  // cells of every (dotCount / CHURN_SAMPLES)th dot at the last update
+  std::vector<uint32_t> sampleCell;
+  size_t sampleDots = 0; // dot count the samples were taken at, 0 for none
 
+public:
+  // the dots of one cell, iterable with range-for
+  struct CellSpan {
+    const uint32_t *indices;
+    uint32_t count;
+
+    const uint32_t *begin() const { return indices; }
+    const uint32_t *end() const { return indices + count; }
+  };
 
 public:
   SpatialGrid()
       : cell_width(Settings::SCREEN_WIDTH / float(GRID_WIDTH)),
-        cell_height(Settings::SCREEN_HEIGHT / float(GRID_HEIGHT)) {}
+        cell_height(Settings::SCREEN_HEIGHT / float(GRID_HEIGHT)),
+        cellStart(CELL_COUNT + 1, 0), cellCount(CELL_COUNT, 0),
+        cellCursor(CELL_COUNT, 0) {}
 
-  void clear() { memset(Grid, 0, sizeof(Grid)); }
+  /// Cell key of a position, positions outside the screen go to edge cells
+  uint32_t cellKey(float x, float y) const {
+    int gx = std::clamp(static_cast<int>(x / cell_width), 0, GRID_WIDTH - 1);
+    int gy = std::clamp(static_cast<int>(y / cell_height), 0, GRID_HEIGHT - 1);
+    return static_cast<uint32_t>(gy * GRID_WIDTH + gx);
+  }
 
+  CellSpan cell(int gx, int gy) const {
+    const uint32_t key = gy * GRID_WIDTH + gx;
+    return {cellIndices.data() + cellStart[key], cellCount[key]};
+  }
+
+  /*
+   * Sorts the alive dots into the grid. alive_indices is dense after
+   * Dots::compact, so there is no dead dot check in here.
+   *
+   * @param dots The dots to sort into the grid
+   */
   void rebuild(const Dots &dots) {
-    clear();
+    rebuild(dots.alive_indices, dots.size(), [&dots, this](size_t i) {
+      return cellKey(dots.positions_x[i], dots.positions_y[i]);
+    });
+  }
+
+  /*
+   * Parallel version of rebuild. Every chunk of dots counts into its own
+   * histogram, a prefix sum over (cell, chunk) turns those into write
+   * positions, and the chunks then scatter in parallel. Chunk order matches
+   * dot order, so the result is exactly the same as the serial rebuild.
+   *
+   * @param dots The dots to sort into the grid
+   * @param threadPool The pool to run the chunks on
+   */
+  void rebuild(const Dots &dots, ThreadPool *threadPool) {
+    rebuild(
+        dots.alive_indices, dots.size(),
+        [&dots, this](size_t i) {
+          return cellKey(dots.positions_x[i], dots.positions_y[i]);
+        },
+        threadPool);
+  }
+
+  /*
+   * Same for the compact layout, the alive set still lives in Dots
+   *
+   * @param dots The quantized dots
+   * @param aliveIndices The dots to sort into the grid
+   * @param threadPool The pool to run the chunks on, null runs serial
+   */
+  void rebuild(const CompactDots &dots, const std::vector<size_t> &aliveIndices,
+               ThreadPool *threadPool) {
+    auto keyOf = [&dots, this](size_t i) {
+      return cellKey(dots.x(i), dots.y(i));
+    };
+    if (threadPool)
+      rebuild(aliveIndices, dots.size(), keyOf, threadPool);
+    else
+      rebuild(aliveIndices, dots.size(), keyOf);
+  }
+
+  /*
+   * Brings the grid up to date with the dots. Same as the parallel rebuild
+   * unless the grid is incremental: then every dot compares its cell with
+   * the one it sits in, the chunks collect the dots that moved into their
+   * own lists, and only those are taken out of their old cell and put into
+   * the new one. Every dot has to be alive for that, the grid finds the
+   * dots by index.
+   *
+   * @param dots The dots to sort into the grid
+   * @param threadPool The pool to run the chunks on
+   */
+  void update(const Dots &dots, ThreadPool *threadPool) {
+    update(
+        dots.alive_indices, dots.size(),
+        [&dots, this](size_t i) {
+          return cellKey(dots.positions_x[i], dots.positions_y[i]);
+        },
+        threadPool);
+  }
+  void update(const CompactDots &dots, const std::vector<size_t> &aliveIndices,
+              ThreadPool *threadPool) {
+    update(
+        aliveIndices, dots.size(),
+        [&dots, this](size_t i) { return cellKey(dots.x(i), dots.y(i)); },
+        threadPool);
+  }
+
+  /*
+   * Turns the incremental mode on or off, takes effect at the next rebuild
+   *
+   * @param enabled Keep slack in every cell and move dots in update()
+   * @param threshold Fraction of the dots that may change cell in one
+   *                  update before it does a full rebuild instead
+   */
+  void setIncremental(bool enabled,
+                      float threshold = DEFAULT_CHURN_THRESHOLD) {
+    incremental = enabled;
+    churnThreshold = threshold;
+    tracked = false;
+  }
+  bool isIncremental() const { return incremental; }
+  /// The dots changed index (reorder, resize), the next update rebuilds
+  void invalidate() {
+    tracked = false;
+    sampleDots = 0;
+  }
+  /// Fraction of the dots that changed cell in the last update, 1 when the
+  /// grid was not tracking them and had to rebuild anyway
+  float getLastChurn() const { return lastChurn; }
+  /// False if the last update rebuilt the grid from scratch
+  bool wasLastUpdateIncremental() const { return lastUpdateIncremental; }
+
+  /*
+   * True if both grids hold the same dots in the same cells. The order
+   * inside the cells is compared too, unless either grid moved dots
+   * incrementally, which leaves them in another order.
+   */
+  bool sameContents(const SpatialGrid &other) const {
+    const bool ordered = rebuildOrder && other.rebuildOrder;
+    std::vector<uint32_t> mine;
+    std::vector<uint32_t> theirs;
+    for (int c = 0; c < CELL_COUNT; c++) {
+      const CellSpan a = {cellIndices.data() + cellStart[c], cellCount[c]};
+      const CellSpan b = {other.cellIndices.data() + other.cellStart[c],
+                          other.cellCount[c]};
+      if (a.count != b.count)
+        return false;
+      mine.assign(a.begin(), a.end());
+      theirs.assign(b.begin(), b.end());
+      if (!ordered) {
+        std::sort(mine.begin(), mine.end());
+        std::sort(theirs.begin(), theirs.end());
+      }
+      if (mine != theirs)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  // free slots behind a cell of count dots, none unless tracked
+  uint32_t slackFor(uint32_t count) const {
+    return tracked ? count / 2 + MIN_SLACK : 0;
+  }
+
+  // every dot index has to be in the grid to be tracked
+  void beginTracking(size_t aliveCount, size_t dotCount, bool track) {
+    tracked = track && incremental && aliveCount == dotCount;
+    rebuildOrder = true;
+    if (tracked) {
+      dotCell.resize(dotCount);
+      dotSlot.resize(dotCount);
+    }
+  }
+
+  // the counting sort itself, keyOf(dot index) gives the cell of a dot.
+  // Without track there is no slack and the next update rebuilds again
+  template <typename KeyOf>
+  void rebuild(const std::vector<size_t> &aliveIndices, size_t dotCount,
+               KeyOf keyOf, bool track = true) {
+    const size_t aliveCount = aliveIndices.size();
+    dotKeys.resize(aliveCount);
+    std::fill(cellCursor.begin(), cellCursor.end(), 0);
+    beginTracking(aliveCount, dotCount, track);
+
+    // pass 1: count the dots per cell
+    for (size_t k = 0; k < aliveCount; k++) {
+      uint32_t key = keyOf(aliveIndices[k]);
+      dotKeys[k] = key;
+      cellCursor[key]++;
+    }
+
+    // exclusive prefix sum, the counts turn into write positions
+    uint32_t offset = 0;
+    for (int c = 0; c < CELL_COUNT; c++) {
+      cellStart[c] = offset;
+      cellCount[c] = cellCursor[c];
+      offset += cellCursor[c] + slackFor(cellCursor[c]);
+      cellCursor[c] = cellStart[c];
+    }
+    cellStart[CELL_COUNT] = offset;
+    gridDots = aliveCount;
 
-    for (size_t i : dots.alive_indices) {
-      // skip dead dots
-      if (dots.radii[i] >= Dots::RADIUS + 3)
-        continue;
+    // pass 2: scatter the indices into their cells, keeps the dot order
+    cellIndices.resize(offset);
+    for (size_t k = 0; k < aliveCount; k++) {
+      uint32_t key = dotKeys[k];
+      uint32_t slot = cellCursor[key]++;
+      cellIndices[slot] = static_cast<uint32_t>(aliveIndices[k]);
+      if (tracked) {
+        dotCell[aliveIndices[k]] = key;
+        dotSlot[aliveIndices[k]] = slot;
+      }
+    }
+  }
+
+  template <typename KeyOf>
+  void rebuild(const std::vector<size_t> &aliveIndices, size_t dotCount,
+               KeyOf keyOf, ThreadPool *threadPool, bool track = true) {
+    PROFILE_SCOPE("grid_build");
+    const size_t aliveCount = aliveIndices.size();
+    const size_t maxChunks = size_t(threadPool->num_threads) * 2;
+    const size_t numChunks =
+        std::clamp(aliveCount / MIN_DOTS_PER_CHUNK, size_t(1), maxChunks);
+    if (numChunks == 1) {
+      rebuild(aliveIndices, dotCount, keyOf, track);
+      return;
+    }
+
+    const size_t chunkSize = (aliveCount + numChunks - 1) / numChunks;
+    dotKeys.resize(aliveCount);
+    chunkCounts.resize(numChunks * CELL_COUNT);
+    beginTracking(aliveCount, dotCount, track);
+
+    // pass 1: every chunk counts into its own histogram
+    threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+      PROFILE_SCOPE("grid_count");
+      for (size_t chunk = first; chunk < last; chunk++) {
+        uint32_t *counts = chunkCounts.data() + chunk * CELL_COUNT;
+        std::fill(counts, counts + CELL_COUNT, 0);
+
+        const size_t end = std::min(aliveCount, (chunk + 1) * chunkSize);
+        for (size_t k = chunk * chunkSize; k < end; k++) {
+          uint32_t key = keyOf(aliveIndices[k]);
+          dotKeys[k] = key;
+          counts[key]++;
+        }
+      }
+    });
+
+    // exclusive prefix sum, cell major so every cell stays contiguous and
+    // lower chunks come first inside a cell
+    uint32_t offset = 0;
+    for (int c = 0; c < CELL_COUNT; c++) {
+      cellStart[c] = offset;
+      for (size_t chunk = 0; chunk < numChunks; chunk++) {
+        uint32_t &count = chunkCounts[chunk * CELL_COUNT + c];
+        uint32_t chunkOffset = offset;
+        offset += count;
+        count = chunkOffset;
+      }
+      cellCount[c] = offset - cellStart[c];
+      offset += slackFor(cellCount[c]);
+    }
+    cellStart[CELL_COUNT] = offset;
+    gridDots = aliveCount;
+
+    // pass 2: every chunk scatters into its own slots
+    cellIndices.resize(offset);
+    threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+      PROFILE_SCOPE("grid_scatter");
+      for (size_t chunk = first; chunk < last; chunk++) {
+        uint32_t *cursor = chunkCounts.data() + chunk * CELL_COUNT;
+        const size_t end = std::min(aliveCount, (chunk + 1) * chunkSize);
+        for (size_t k = chunk * chunkSize; k < end; k++) {
+          uint32_t key = dotKeys[k];
+          uint32_t slot = cursor[key]++;
+          cellIndices[slot] = static_cast<uint32_t>(aliveIndices[k]);
+          if (tracked) {
+            dotCell[aliveIndices[k]] = key;
+            dotSlot[aliveIndices[k]] = slot;
+          }
+        }
+      }
+    });
+  }
+
+  /*
+   * Estimates the churn from every (dotCount / CHURN_SAMPLES)th dot, and
+   * remembers their cells for the next update
+   *
+   * @return The fraction of the sampled dots that changed cell, negative
+   *         if there was no earlier sample to compare with
+   */
+  template <typename KeyOf> float sampleChurn(size_t dotCount, KeyOf keyOf) {
+    const size_t samples = std::min(dotCount, CHURN_SAMPLES);
+    const size_t stride = samples > 0 ? dotCount / samples : 1;
+    const bool comparable = sampleDots == dotCount && samples > 0;
+    sampleCell.resize(samples);
+    size_t moved = 0;
+    for (size_t s = 0; s < samples; s++) {
+      const uint32_t key = keyOf(s * stride);
+      moved += key != sampleCell[s];
+      sampleCell[s] = key;
+    }
+    sampleDots = dotCount;
+    return comparable ? float(moved) / samples : -1.f;
+  }
+
+  template <typename KeyOf>
+  void update(const std::vector<size_t> &aliveIndices, size_t dotCount,
+              KeyOf keyOf, ThreadPool *threadPool) {
+    lastUpdateIncremental = false;
+    if (!incremental) {
+      lastChurn = 1.f;
+      rebuild(aliveIndices, dotCount, keyOf, threadPool);
+      return;
+    }
 
-      int gx = static_cast<int>(dots.positions_x[i] / cell_width);
-      int gy = static_cast<int>(dots.positions_y[i] / cell_height);
+    // busy step, the slack and the tracking would only cost time
+    const float estimate = sampleChurn(dotCount, keyOf);
+    if (estimate > churnThreshold) {
+      lastChurn = estimate;
+      rebuild(aliveIndices, dotCount, keyOf, threadPool, false);
+      return;
+    }
+    if (!tracked || aliveIndices.size() != dotCount ||
+        dotCell.size() != dotCount) {
+      lastChurn = estimate < 0.f ? 1.f : estimate;
+      rebuild(aliveIndices, dotCount, keyOf, threadPool);
+      return;
+    }
 
-      // bounds check
-      if (gx >= 0 && gx < GRID_WIDTH && gy >= 0 && gy < GRID_HEIGHT) {
-        Cell &cell = Grid[gy][gx];
-        if (cell.count < CELL_CAPACITY) {
-          cell.indices[cell.count++] = static_cast<uint16_t>(i);
+    PROFILE_SCOPE("grid_update");
+    // pass 1: every chunk lists its dots that changed cell, and keeps every
+    // key, so a fallback rebuild does not work them out again
+    const size_t numChunks =
+        std::max<size_t>(1, (dotCount + UPDATE_GRAIN - 1) / UPDATE_GRAIN);
+    chunkMoves.resize(numChunks);
+    newCell.resize(dotCount);
+    threadPool->parallel_for(0, numChunks, 1, [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; chunk++) {
+        auto &moves = chunkMoves[chunk];
+        moves.clear();
+        const size_t end = std::min(dotCount, (chunk + 1) * UPDATE_GRAIN);
+        for (size_t i = chunk * UPDATE_GRAIN; i < end; i++) {
+          const uint32_t key = keyOf(i);
+          newCell[i] = key;
+          if (key != dotCell[i])
+            moves.push_back({static_cast<uint32_t>(i), key});
         }
       }
+    });
+    auto knownKey = [this](size_t i) { return newCell[i]; };
+
+    size_t moveCount = 0;
+    for (const auto &moves : chunkMoves)
+      moveCount += moves.size();
+    lastChurn = dotCount > 0 ? float(moveCount) / dotCount : 0.f;
+    if (lastChurn > churnThreshold) {
+      rebuild(aliveIndices, dotCount, knownKey, threadPool);
+      return;
     }
+
+    // pass 2: move them, in chunk order so the result does not depend on
+    // the threads. The last dot of the old cell fills the hole.
+    rebuildOrder = false;
+    for (const auto &moves : chunkMoves) {
+      for (const Move &move : moves) {
+        const uint32_t to = move.cell;
+        if (cellCount[to] == cellStart[to + 1] - cellStart[to]) {
+          // out of slack, the rebuild gives every cell room again
+          rebuild(aliveIndices, dotCount, knownKey, threadPool);
+          return;
+        }
+        const uint32_t from = dotCell[move.dot];
+        const uint32_t lastSlot = cellStart[from] + --cellCount[from];
+        const uint32_t filler = cellIndices[lastSlot];
+        cellIndices[dotSlot[move.dot]] = filler;
+        dotSlot[filler] = dotSlot[move.dot];
+
+        const uint32_t slot = cellStart[to] + cellCount[to]++;
+        cellIndices[slot] = move.dot;
+        dotSlot[move.dot] = slot;
+        dotCell[move.dot] = to;
+      }
+    }
+    lastUpdateIncremental = true;
   }
 
+public:
+
   template <typename Callback>
   void queryNeighbours(float x, float y, float radius, Callback cb) const {
     int min_gx = std::max(0, static_cast<int>((x - radius) / cell_width));
     int max_gx =
-        std::min(GRID_WIDTH, static_cast<int>((x + radius) / cell_width));
+        std::min(GRID_WIDTH - 1, static_cast<int>((x + radius) / cell_width));
     int min_gy = std::max(0, static_cast<int>((y - radius) / cell_height));
     int max_gy =
-        std::min(GRID_HEIGHT, static_cast<int>((y + radius) / cell_height));
+        std::min(GRID_HEIGHT - 1, static_cast<int>((y + radius) / cell_height));
 
     for (int gy = min_gy; gy <= max_gy; gy++) {
       for (int gx = min_gx; gx <= max_gx; gx++) {
-        const Cell &cell = Grid[gy][gx];
-        for (size_t i = 0; i < cell.count; i++) {
-          cb(cell.indices[i]);
+        for (uint32_t index : cell(gx, gy)) {
+          cb(index);
         }
       }
     }
@@ -75,26 +478,51 @@ public:
   // Debug stats
   size_t getOccupiedCells() const {
     size_t occupied = 0;
-    for (int y = 0; y < GRID_HEIGHT; y++) {
-      for (int x = 0; x < GRID_WIDTH; x++) {
-        if (Grid[y][x].count > 0)
-          occupied++;
-      }
+    for (int c = 0; c < CELL_COUNT; c++) {
+      if (cellCount[c] > 0)
+        occupied++;
     }
     return occupied;
   }
 
   float getAverageDotsPerCell() const {
-    size_t total_dots = 0;
-    size_t occupied_cells = 0;
-    for (int y = 0; y < GRID_HEIGHT; y++) {
-      for (int x = 0; x < GRID_WIDTH; x++) {
-        if (Grid[y][x].count > 0) {
-          total_dots += Grid[y][x].count;
-          occupied_cells++;
-        }
-      }
-    }
-    return occupied_cells > 0 ? float(total_dots) / occupied_cells : 0;
+    size_t occupied_cells = getOccupiedCells();
+    return occupied_cells > 0 ? float(gridDots) / occupied_cells : 0;
+  }
+
+  /*
+   * Memory locality of the dots, the mean index distance |i - j| over every
+   * pair of dots sharing a cell. Around the dot count / 3 when neighbours
+   * sit at random indices, under 1% of the dot count after a morton sort.
+   *
+   * @param threadPool The pool to split the cells over
+   */
+  double getMeanIndexDistance(ThreadPool *threadPool) const {
+    struct Sum {
+      double distance = 0.0;
+      uint64_t pairs = 0;
+    };
+    const Sum total = threadPool->parallel_reduce(
+        0, CELL_COUNT, GRID_WIDTH, Sum{},
+        [this](size_t first, size_t last) {
+          Sum sum;
+          for (size_t c = first; c < last; c++) {
+            const uint32_t *indices = cellIndices.data() + cellStart[c];
+            const uint32_t count = cellCount[c];
+            for (uint32_t a = 0; a < count; a++) {
+              for (uint32_t b = a + 1; b < count; b++) {
+                sum.distance += indices[a] > indices[b]
+                                    ? indices[a] - indices[b]
+                                    : indices[b] - indices[a];
+              }
+            }
+            sum.pairs += uint64_t(count) * (count - 1) / 2;
+          }
+          return sum;
+        },
+        [](Sum a, Sum b) {
+          return Sum{a.distance + b.distance, a.pairs + b.pairs};
+        });
+    return total.pairs > 0 ? total.distance / total.pairs : 0.0;
   }
 };
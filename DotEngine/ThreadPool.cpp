@@ -1,14 +1,22 @@
 #include "ThreadPool.h"
+#include "ScopeProfiler.h"
+#include <algorithm>
 #include <iostream>
 
+// index of the worker running on this thread, -1 on the main thread
+static thread_local int s_workerIndex = -1;
+
 ThreadPool::ThreadPool()
-  : num_threads(std::thread::hardware_concurrency())
+  : num_threads(std::max(1u, std::thread::hardware_concurrency()))
 
 {
   // RaII
   std::cout << "[ThreadPool] Creating Threads" << "\n";
   for(uint32_t i = 0; i < num_threads; ++i){
-    m_threads.emplace_back(std::thread(&ThreadPool::threadLoop, this));
+    m_queues.emplace_back(std::make_unique<WorkQueue>());
+  }
+  for(uint32_t i = 0; i < num_threads; ++i){
+    m_threads.emplace_back(std::thread(&ThreadPool::threadLoop, this, i));
   }
   std::cout << "[ThreadPool] Threads Created" << "\n";
 }
@@ -17,57 +25,140 @@ ThreadPool::~ThreadPool(){
   stop();
 }
 
-void ThreadPool::threadLoop(){
+int ThreadPool::workerIndex(){
+  return s_workerIndex;
+}
+
+void ThreadPool::threadLoop(uint32_t index){
+  s_workerIndex = static_cast<int>(index);
+  ScopeProfiler::SetThreadName("worker " + std::to_string(index));
   while(true){
-    std::function<void()> job;
-    {
-      // lock this scope, other thread will wait
-      std::unique_lock<std::mutex> lock(m_queue_mutex);
-      // unlock mutex and wait for new work or termination,
-      // else lock mutex and continue
-      m_queue_condition.wait(lock, [this]{
-        return !m_jobs.empty() || shouldTerminate;
-      });
-      if(shouldTerminate){
-        return;
-      }
-      // get the next job
-      job = m_jobs.front();
-      m_jobs.pop();
+    if(shouldTerminate.load()){
+      return;
     }
-    // execute the job
-    job();
-    {
-      std::unique_lock<std::mutex> lock(m_completion_mutex);
-      m_active_jobs--;
+    // keep going as long as there is anything to run or steal
+    if(tryRunJob(index)){
+      continue;
     }
+
+    // nothing left anywhere, sleep until new work or termination
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    m_sleeping_threads++;
+    m_sleep_condition.wait(lock, [this]{
+      return m_queued_jobs.load() > 0 || shouldTerminate.load();
+    });
+    m_sleeping_threads--;
+  }
+}
+
+bool ThreadPool::popJob(uint32_t firstQueue, std::function<void()> &job){
+  if(m_queued_jobs.load(std::memory_order_acquire) == 0){
+    return false;
+  }
+
+  // own deque first, oldest job first so ranges are walked forwards
+  const int self = s_workerIndex;
+  if(self >= 0){
+    WorkQueue &own = *m_queues[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if(!own.jobs.empty()){
+      job = std::move(own.jobs.front());
+      own.jobs.pop_front();
+      m_queued_jobs--;
+      return true;
+    }
+  }
+
+  // steal from the back of the others, far away from where the owner works
+  for(uint32_t i = 0; i < num_threads; ++i){
+    uint32_t q = (firstQueue + i) % num_threads;
+    if(static_cast<int>(q) == self){
+      continue;
+    }
+    WorkQueue &victim = *m_queues[q];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if(!victim.jobs.empty()){
+      job = std::move(victim.jobs.back());
+      victim.jobs.pop_back();
+      m_queued_jobs--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::tryRunJob(uint32_t firstQueue){
+  std::function<void()> job;
+  if(!popJob(firstQueue, job)){
+    return false;
+  }
+  // execute the job
+  {
+    PROFILE_SCOPE("pool_job");
+    job();
+  }
+
+  // only the last job takes the completion lock
+  if(m_active_jobs.fetch_sub(1) == 1){
+    std::lock_guard<std::mutex> lock(m_completion_mutex);
     m_completion_condition.notify_all(); // make some noise
   }
+  return true;
 }
 
-void ThreadPool::queueJob(const std::function<void()>& job){
+void ThreadPool::push(std::function<void()> job, size_t queueIndex){
+  m_active_jobs++;
   {
-    std::unique_lock<std::mutex> lock(m_queue_mutex);
-    m_jobs.push(job);
-    m_active_jobs++;
+    WorkQueue &queue = *m_queues[queueIndex % num_threads];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(std::move(job));
+  }
+  m_queued_jobs++;
+
+  // wake up a sleeping thread, the lock makes sure it is really waiting
+  if(m_sleeping_threads.load() > 0){
+    { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+    m_sleep_condition.notify_one();
   }
-  // wake up any locked threads
-  m_queue_condition.notify_one();
+}
+
+void ThreadPool::helpUntil(const std::atomic<size_t> &remaining){
+  // jobs run while helping show up nested inside this
+  PROFILE_SCOPE("wait_for_threads");
+  const uint32_t firstQueue = s_workerIndex >= 0 ? s_workerIndex : 0;
+  while(remaining.load(std::memory_order_acquire) > 0){
+    if(!tryRunJob(firstQueue)){
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ThreadPool::queueJob(const std::function<void()>& job){
+  // jobs queued from a worker stay on that worker, others round robin
+  size_t queueIndex = s_workerIndex >= 0 ? s_workerIndex : m_nextQueue++;
+  push(job, queueIndex);
 }
 
 void ThreadPool::wait(){
-  std::unique_lock<std::mutex> lock(m_completion_mutex);
-  m_completion_condition.wait(lock, [this]{
-    return m_active_jobs.load() <= 0;
-  });
+  const uint32_t firstQueue = s_workerIndex >= 0 ? s_workerIndex : 0;
+  while(m_active_jobs.load() > 0){
+    // help out instead of just sleeping
+    if(tryRunJob(firstQueue)){
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_completion_mutex);
+    m_completion_condition.wait(lock, [this]{
+      return m_active_jobs.load() == 0 || m_queued_jobs.load() > 0;
+    });
+  }
 }
 
 void ThreadPool::stop(){
   {
-    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
     shouldTerminate = true;
   }
-  m_queue_condition.notify_all();
+  m_sleep_condition.notify_all();
   for(std::thread& activeThread : m_threads){
     activeThread.join();
   }
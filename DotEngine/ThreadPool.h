@@ -1,9 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
-#include <queue>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
 
 class ThreadPool{
 public:
@@ -11,21 +15,120 @@ public:
   ~ThreadPool();
   void queueJob(const std::function<void()>& job);
   void stop();
+  /// Waits for every queued job, the calling thread helps out meanwhile
   void wait();
 
+  /*
+   * Runs fn over [begin, end) split into chunks of roughly grain elements.
+   * Chunks are spread over the worker deques and stolen by idle workers, so
+   * uneven chunks balance out. The calling thread helps until all chunks are
+   * done. Only waits for its own chunks, not for other queued jobs.
+   *
+   * @param begin First index
+   * @param end One past the last index
+   * @param grain Number of indices per chunk
+   * @param fn Called as fn(chunkBegin, chunkEnd)
+   */
+  template <typename Fn>
+  void parallel_for(size_t begin, size_t end, size_t grain, Fn &&fn);
+
+  /*
+   * Same splitting as parallel_for, but every chunk returns a value which is
+   * combined in chunk order, so the result does not depend on scheduling.
+   *
+   * @param identity The starting value
+   * @param map Called as map(chunkBegin, chunkEnd), returns a T
+   * @param combine Called as combine(T, T), returns a T
+   */
+  template <typename T, typename Map, typename Combine>
+  T parallel_reduce(size_t begin, size_t end, size_t grain, T identity,
+                    Map &&map, Combine &&combine);
+
+  /// Index of the calling worker thread, -1 for any other thread
+  static int workerIndex();
+
   const uint32_t num_threads;
 private:
-  void threadLoop();
+  // every worker owns a deque, runs its own jobs from the front and steals
+  // from the back of the others
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> jobs;
+  };
+
+  void threadLoop(uint32_t index);
+  void push(std::function<void()> job, size_t queueIndex);
+  bool tryRunJob(uint32_t firstQueue);
+  bool popJob(uint32_t firstQueue, std::function<void()> &job);
+  void helpUntil(const std::atomic<size_t> &remaining);
 
   std::vector<std::thread> m_threads;
-  std::queue<std::function<void()>> m_jobs;
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::atomic<uint32_t> m_nextQueue = 0;
 
-  bool shouldTerminate = false;
+  std::atomic<bool> shouldTerminate = false;
 
-  std::mutex m_queue_mutex;
-  std::condition_variable m_queue_condition;
+  // jobs sitting in the deques, workers only sleep when this is 0
+  std::atomic<size_t> m_queued_jobs = 0;
+  std::atomic<uint32_t> m_sleeping_threads = 0;
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_sleep_condition;
 
   std::atomic<size_t> m_active_jobs = 0;
   std::mutex m_completion_mutex;
   std::condition_variable m_completion_condition;
 };
+
+template <typename Fn>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              Fn &&fn) {
+  if (begin >= end)
+    return;
+  if (grain == 0)
+    grain = 1;
+
+  const size_t chunks = (end - begin + grain - 1) / grain;
+  if (chunks == 1) {
+    fn(begin, end);
+    return;
+  }
+
+  // the last chunk runs on this thread, the rest goes to the workers in
+  // contiguous blocks so neighbouring chunks stay on the same worker
+  std::atomic<size_t> remaining = chunks - 1;
+  const size_t perQueue = (chunks - 1 + num_threads - 1) / num_threads;
+  for (size_t c = 0; c + 1 < chunks; ++c) {
+    size_t chunkBegin = begin + c * grain;
+    size_t chunkEnd = std::min(end, chunkBegin + grain);
+    push([&fn, &remaining, chunkBegin, chunkEnd] {
+      fn(chunkBegin, chunkEnd);
+      remaining.fetch_sub(1, std::memory_order_release);
+    }, c / perQueue);
+  }
+
+  fn(begin + (chunks - 1) * grain, end);
+  helpUntil(remaining);
+}
+
+template <typename T, typename Map, typename Combine>
+T ThreadPool::parallel_reduce(size_t begin, size_t end, size_t grain,
+                              T identity, Map &&map, Combine &&combine) {
+  if (begin >= end)
+    return identity;
+  if (grain == 0)
+    grain = 1;
+
+  const size_t chunks = (end - begin + grain - 1) / grain;
+  std::vector<T> partials(chunks, identity);
+  parallel_for(0, chunks, 1, [&](size_t first, size_t last) {
+    for (size_t c = first; c < last; ++c) {
+      size_t chunkBegin = begin + c * grain;
+      partials[c] = map(chunkBegin, std::min(end, chunkBegin + grain));
+    }
+  });
+
+  T result = identity;
+  for (const T &partial : partials)
+    result = combine(result, partial);
+  return result;
+}
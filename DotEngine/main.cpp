@@ -1,19 +1,43 @@
+#include "Benchmark.h"
 #include "DotRenderer.h"
 #include "FrameTime.h"
 #include "Game.h"
 #include "Settings.h"
+#include "Simd.h"
 #include <Debug.h>
 #include "SimpleProfiler.h"
+#include "ScopeProfiler.h"
 #include <SDL3/SDL.h>
 #include <SDL3_ttf/SDL_ttf.h>
+#include <cstdio>
 #include <string>
 #include "Dots.h"
 #include "ThreadPool.h"
 
 
-int main() {
+int main(int argc, char *argv[]) {
+  BenchmarkOptions options;
+  if (!Benchmark::ParseArgs(argc, argv, options)) {
+    Benchmark::PrintUsage();
+    return 1;
+  }
+
+  // before any kernel runs, the level is read on every call
+  if (Simd::setLevel(options.simd) != options.simd)
+    Debug::LogWarning(std::string("[Simd] ") + Simd::name(options.simd) +
+                      " is not supported here");
+  Debug::Log(std::string("[Simd] running ") + Simd::name(Simd::active()) +
+             " kernels");
+
+  // no window, no font, just simulate and write the report
+  if (options.headless)
+    return Benchmark::Run(options);
+
   Debug::Log("PROGRAM START");
 
+  if (options.hasSeed)
+    Dots::setSeed(options.seed);
+
   if (!SDL_Init(SDL_INIT_VIDEO)) {
     const char *err = SDL_GetError();
     Debug::LogError(err);
@@ -35,6 +59,8 @@ int main() {
 
   SimpleProfiler* profiler = new SimpleProfiler();
   auto& totalClock = profiler->start("total");
+  // render timings get their own root, the simulation thread owns "total"
+  auto& renderClock = profiler->start("render_total");
 
   DotRenderer *renderer = new DotRenderer(window, threadPool, totalClock);
 
@@ -60,9 +86,15 @@ int main() {
   renderer->SetDrawColor(0x00, 0x00, 0x00, 0xFF);
 
   Debug *debug = new Debug(renderer, font);
-  Game *game = new Game(renderer, threadPool, totalClock);
+  Game *game = new Game(renderer, threadPool, totalClock, options.dotCount);
+  game->setCollisionMode(options.collisionMode);
+  // a failed load keeps the random dots
+  if (!options.loadPath.empty())
+    game->loadDots(options.loadPath);
 
   FrameTime frameTime;
+  // simulate the next frame while the current one is rendered and presented
+  bool pipelined = true;
 
   bool quit = false;
   SDL_Event e;
@@ -77,7 +109,9 @@ int main() {
 
   // text debug
 
+  ScopeProfiler::SetThreadName("main");
   while (!quit) {
+    PROFILE_SCOPE("frame");
     currentTick = SDL_GetPerformanceCounter();
     deltaTime =
         (double)(currentTick - lastTick) / SDL_GetPerformanceFrequency();
@@ -103,35 +137,90 @@ int main() {
       case SDL_EVENT_KEY_DOWN:
         if (e.key.key == SDLK_ESCAPE)
           quit = true;
+        // resize the population at runtime
+        else if (e.key.key == SDLK_EQUALS)
+          game->resizeDots(game->getDotCount() * 2);
+        else if (e.key.key == SDLK_MINUS && game->getDotCount() > 1)
+          game->resizeDots(game->getDotCount() / 2);
+        // rasterize into the locked texture or the CPU buffer
+        else if (e.key.key == SDLK_F5)
+          renderer->SetRenderToTexture(!renderer->GetRenderToTexture());
+        else if (e.key.key == SDLK_F6)
+          pipelined = !pipelined;
+        // record the PROFILE_SCOPEs, printed with the timer report
+        else if (e.key.key == SDLK_F7)
+          ScopeProfiler::SetEnabled(!ScopeProfiler::IsEnabled());
+        // capture the current dots, replay them with --load
+        else if (e.key.key == SDLK_F9)
+          game->saveDots("snapshot.dots");
+        // float or quantized dots
+        else if (e.key.key == SDLK_F10)
+          game->setDotLayout(game->getDotLayout() == Game::DotLayout::Float
+                                 ? Game::DotLayout::Compact
+                                 : Game::DotLayout::Float);
+        // start capturing a trace, the second press writes it
+        else if (e.key.key == SDLK_F8) {
+          if (ScopeProfiler::IsTracing()) {
+            ScopeProfiler::Collect();
+            ScopeProfiler::SetTracing(false);
+            if (ScopeProfiler::WriteChromeTrace("trace.json"))
+              Debug::Log("Trace saved to trace.json");
+          } else {
+            ScopeProfiler::Reset();
+            ScopeProfiler::SetTracing(true);
+          }
+        }
         break;
       }
     }
 
     totalClock.startClock();
+    renderClock.startClock();
     renderer->SetDrawColor(0x00, 0x00, 0x00, 0xFF);
     renderer->Clear();
 
-    game->Update(deltaTime);
-    totalClock.stopClock();
+    if (pipelined) {
+      game->beginFrame(deltaTime);
+      game->renderFrame(renderClock);
+    } else {
+      game->Update(deltaTime);
+      totalClock.stopClock();
+    }
 
     // - DEBUG
     std::string fpsText = "FPS: " + std::to_string(static_cast<int>(fps));
     debug->UpdateScreenField("fps", fpsText);
-    std::string onePLow =
-        "1% LOW: " + std::to_string(static_cast<int>(frameTime.onepercentlow)) +
-        "ms";
-    debug->UpdateScreenField("opl", onePLow);
+    // frame time percentiles over the last 1000 frames
+    char percentiles[64];
+    snprintf(percentiles, sizeof(percentiles), "P50: %.1fms  P99: %.1fms",
+             frameTime.p50, frameTime.p99);
+    debug->UpdateScreenField("p50_p99", percentiles);
+    snprintf(percentiles, sizeof(percentiles), "P99.9: %.1fms  MAX: %.1fms",
+             frameTime.p999, frameTime.max);
+    debug->UpdateScreenField("p999_max", percentiles);
 
     renderer->SetDrawColor(0, 0, 0, 150);
-    renderer->DrawRect(0, 0, 300, 270);
+    renderer->DrawRect(0, 0, 300, 300);
 
     debug->Render();
 
     renderer->Present();
+    renderClock.stopClock();
+
+    // the frame takes as long as the slower of simulating and presenting
+    if (pipelined) {
+      game->endFrame();
+      totalClock.stopClock();
+    }
+
+    if (ScopeProfiler::IsEnabled())
+      ScopeProfiler::Collect();
 
     static int pFrameCount=0;
     if(++pFrameCount % 60 == 0){
       profiler->reportTimersFull(true);
+      if (ScopeProfiler::IsEnabled())
+        printf("%s", ScopeProfiler::GetStatsCSV().c_str());
     }
   }
 